@@ -0,0 +1,5050 @@
+#ifndef __ZIP_ARCHIVE_HH__
+#define __ZIP_ARCHIVE_HH__
+
+#ifndef ZIP_NO_XRDCL
+#include "XrdCl/XrdClXRootDResponses.hh"
+#endif
+
+#include <zlib.h>
+
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdint.h>
+#include <ctime>
+#include <cstring>
+#include <errno.h>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <immintrin.h>
+#define ZIP_CRC32_PCLMUL 1
+#define ZIP_SCAN_SIMD 1
+#endif
+
+#ifdef ZIP_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace XrdCl 
+{
+  
+  const uint16_t ovrflw16 = 0xffff;
+  const uint32_t ovrflw32 = 0xffffffff;
+  const uint64_t ovrflw64 = 0xffffffffffffffff;
+
+#ifdef ZIP_NO_XRDCL
+  // the subset of the XrdCl status and response types used by the engine, so that
+  // the local backends build without an XRootD install (codes as in XrdClStatus.hh)
+  const uint16_t stOK    = 0x0000;
+  const uint16_t stError = 0x0001;
+
+  const uint16_t errNone         = 0;
+  const uint16_t errInvalidOp    = 3;
+  const uint16_t errInternal     = 7;
+  const uint16_t errInvalidArgs  = 9;
+  const uint16_t errOSError      = 12;
+  const uint16_t errNotSupported = 13;
+  const uint16_t errDataError    = 14;
+  const uint16_t errNotFound     = 304;
+
+  struct XRootDStatus
+  {
+      XRootDStatus( uint16_t st = stOK, uint16_t code = errNone, uint32_t errNo = 0, const std::string &message = "" ) :
+        status( st ), code( code ), errNo( errNo ), message( message ) { }
+
+      bool IsOK() const { return status == stOK; }
+      bool IsError() const { return status & stError; }
+      const std::string& GetErrorMessage() const { return message; }
+      std::string ToString() const { return message; }
+
+      uint16_t    status;
+      uint16_t    code;
+      uint32_t    errNo;
+      std::string message;
+  };
+
+  struct AnyObject
+  {
+  };
+
+  struct ResponseHandler
+  {
+      virtual ~ResponseHandler() { }
+
+      virtual void HandleResponse( XRootDStatus *status, AnyObject *response )
+      {
+        delete status;
+        delete response;
+      }
+  };
+
+  struct ChunkInfo
+  {
+      ChunkInfo( uint64_t offset = 0, uint32_t length = 0, void *buffer = 0 ) : offset( offset ), length( length ), buffer( buffer ) { }
+
+      uint64_t  offset;
+      uint32_t  length;
+      void     *buffer;
+  };
+
+  typedef std::vector<ChunkInfo> ChunkList;
+#endif
+
+  // taken from XrdClZipArchiveReader.cc 
+  template<typename RESP>
+  struct ZipHandlerException
+  {
+      ZipHandlerException( XRootDStatus *status, RESP *response ) : status( status ), response( response ) { }
+
+      XRootDStatus *status;
+      RESP         *response;
+  };
+
+  // fixed size pool of worker threads running tasks in submission order
+  class ZipThreadPool
+  {
+    public:
+
+      // nbThreads == 0 means one thread per hardware thread
+      ZipThreadPool( unsigned nbThreads = 0 ) : stop( false )
+      {
+        if ( nbThreads == 0 ) nbThreads = std::thread::hardware_concurrency();
+        if ( nbThreads == 0 ) nbThreads = 1;
+        for ( unsigned i = 0; i < nbThreads; ++i )
+          workers.push_back( std::thread( &ZipThreadPool::Run, this ) );
+      }
+
+      ~ZipThreadPool()
+      {
+        {
+          std::unique_lock<std::mutex> lock( mutex );
+          stop = true;
+        }
+        cv.notify_all();
+        for ( size_t i = 0; i < workers.size(); ++i )
+          workers[i].join();
+      }
+
+      // queue a task, exceptions thrown by the task are rethrown by the future
+      template<typename F>
+      std::future<typename std::result_of<F()>::type> Submit( F task )
+      {
+        typedef typename std::result_of<F()>::type R;
+        std::shared_ptr<std::packaged_task<R()>> pt( new std::packaged_task<R()>( task ) );
+        std::future<R> result = pt->get_future();
+        {
+          std::unique_lock<std::mutex> lock( mutex );
+          tasks.push_back( [pt]() { ( *pt )(); } );
+        }
+        cv.notify_one();
+        return result;
+      }
+
+      unsigned Size() const
+      {
+        return workers.size();
+      }
+
+    private:
+
+      void Run()
+      {
+        while ( true )
+        {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock( mutex );
+            cv.wait( lock, [this]() { return stop || !tasks.empty(); } );
+            if ( tasks.empty() ) return;
+            task = std::move( tasks.front() );
+            tasks.pop_front();
+          }
+          task();
+        }
+      }
+
+      std::vector<std::thread>          workers;
+      std::deque<std::function<void()>> tasks;
+      std::mutex                        mutex;
+      std::condition_variable           cv;
+      bool                              stop;
+  };
+
+  // CRC-32 as used in ZIP archives (reflected polynomial 0xedb88320)
+  // the kernel is selected at runtime: PCLMULQDQ folding if the CPU supports it,
+  // slice-by-16 tables otherwise (the SSE4.2 crc32 instruction computes CRC-32C,
+  // which is a different polynomial, so it cannot be used here)
+  struct ZipCrc32
+  {
+    typedef uint32_t (*Kernel)( uint32_t crc, const unsigned char *buffer, size_t size );
+
+    // update crc (0 for an empty input) with size bytes from buffer
+    static uint32_t Update( uint32_t crc, const void *buffer, size_t size )
+    {
+      static const Kernel kernel = SelectKernel();
+      return ~kernel( ~crc, static_cast<const unsigned char*>( buffer ), size );
+    }
+
+    // CRC-32 of the concatenation of two inputs given the CRC-32 of each part and
+    // the size of the second one, done with multiplications by x^(2^n) in GF(2)[x]
+    // (same approach as crc32_combine() in zlib 1.2.12)
+    static uint32_t Combine( uint32_t crc1, uint32_t crc2, uint64_t size2 )
+    {
+      return MultModP( XPow8n( size2 ), crc1 ) ^ crc2;
+    }
+
+    // CRC-32 of size bytes of the file at the given offset, computed by splitting
+    // the range into chunks checksummed concurrently on the pool and combined in order
+    static uint32_t ComputeParallel( int fd, uint64_t offset, uint64_t size, ZipThreadPool &pool,
+                                     uint64_t chunkSize = defaultChunkSize )
+    {
+      if ( chunkSize == 0 ) chunkSize = defaultChunkSize;
+      std::vector<std::future<uint32_t>> parts;
+      for ( uint64_t done = 0; done < size; done += chunkSize )
+      {
+        uint64_t chunkOffset = offset + done;
+        uint64_t chunkLength = std::min( chunkSize, size - done );
+        parts.push_back( pool.Submit( [fd, chunkOffset, chunkLength]() { return ComputeRange( fd, chunkOffset, chunkLength ); } ) );
+      }
+
+      uint32_t crc = 0;
+      for ( size_t i = 0; i < parts.size(); ++i )
+      {
+        uint64_t chunkLength = std::min( chunkSize, size - i * chunkSize );
+        crc = Combine( crc, parts[i].get(), chunkLength );
+      }
+      return crc;
+    }
+
+    static uint32_t ComputeParallel( int fd, uint64_t offset, uint64_t size, unsigned nbThreads = 0,
+                                     uint64_t chunkSize = defaultChunkSize )
+    {
+      ZipThreadPool pool( nbThreads );
+      return ComputeParallel( fd, offset, size, pool, chunkSize );
+    }
+
+    // CRC-32 of size bytes of the file at the given offset
+    static uint32_t ComputeRange( int fd, uint64_t offset, uint64_t size )
+    {
+      const uint32_t bufferSize = 1024 * 1024;
+      std::unique_ptr<char[]> buffer { new char[bufferSize] };
+      uint32_t crc = 0;
+      while ( size > 0 )
+      {
+        ssize_t bytesRead = pread( fd, buffer.get(), std::min<uint64_t>( bufferSize, size ), offset );
+        if ( bytesRead <= 0 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to read input file." ), 0 );
+        crc = Update( crc, buffer.get(), bytesRead );
+        offset += bytesRead;
+        size -= bytesRead;
+      }
+      return crc;
+    }
+
+    // a * b modulo the CRC polynomial (bit reflected)
+    static uint32_t MultModP( uint32_t a, uint32_t b )
+    {
+      uint32_t m = 1u << 31;
+      uint32_t p = 0;
+      while ( true )
+      {
+        if ( a & m )
+        {
+          p ^= b;
+          if ( ( a & ( m - 1 ) ) == 0 ) break;
+        }
+        m >>= 1;
+        b = ( b & 1 ) ? ( b >> 1 ) ^ poly : b >> 1;
+      }
+      return p;
+    }
+
+    // x^(8 * n) modulo the CRC polynomial
+    static uint32_t XPow8n( uint64_t n )
+    {
+      static const X2nTable x2n;
+      uint32_t p = 1u << 31;
+      unsigned k = 3;
+      while ( n )
+      {
+        if ( n & 1 ) p = MultModP( x2n.t[k & 31], p );
+        n >>= 1;
+        ++k;
+      }
+      return p;
+    }
+
+    // x^(2^n) modulo the CRC polynomial
+    struct X2nTable
+    {
+      X2nTable()
+      {
+        uint32_t p = 1u << 30;
+        t[0] = p;
+        for ( int n = 1; n < 32; ++n )
+          t[n] = p = MultModP( p, p );
+      }
+
+      uint32_t t[32];
+    };
+
+    struct Tables
+    {
+      Tables()
+      {
+        for ( uint32_t i = 0; i < 256; ++i )
+        {
+          uint32_t c = i;
+          for ( int k = 0; k < 8; ++k )
+            c = ( c & 1 ) ? ( c >> 1 ) ^ poly : c >> 1;
+          t[0][i] = c;
+        }
+        for ( uint32_t i = 0; i < 256; ++i )
+          for ( int k = 1; k < 16; ++k )
+            t[k][i] = ( t[k - 1][i] >> 8 ) ^ t[0][t[k - 1][i] & 0xff];
+      }
+
+      uint32_t t[16][256];
+    };
+
+    static const Tables& GetTables()
+    {
+      static const Tables tables;
+      return tables;
+    }
+
+    // portable kernel, works on the inverted crc
+    static uint32_t SliceBy16( uint32_t crc, const unsigned char *buffer, size_t size )
+    {
+      const uint32_t (*t)[256] = GetTables().t;
+      while ( size >= 16 )
+      {
+        uint32_t w0, w1, w2, w3;
+        std::memcpy( &w0, buffer, 4 );
+        std::memcpy( &w1, buffer + 4, 4 );
+        std::memcpy( &w2, buffer + 8, 4 );
+        std::memcpy( &w3, buffer + 12, 4 );
+        w0 ^= crc;
+        crc = t[15][w0 & 0xff] ^ t[14][( w0 >> 8 ) & 0xff] ^ t[13][( w0 >> 16 ) & 0xff] ^ t[12][w0 >> 24]
+            ^ t[11][w1 & 0xff] ^ t[10][( w1 >> 8 ) & 0xff] ^ t[9][( w1 >> 16 ) & 0xff]  ^ t[8][w1 >> 24]
+            ^ t[7][w2 & 0xff]  ^ t[6][( w2 >> 8 ) & 0xff]  ^ t[5][( w2 >> 16 ) & 0xff]  ^ t[4][w2 >> 24]
+            ^ t[3][w3 & 0xff]  ^ t[2][( w3 >> 8 ) & 0xff]  ^ t[1][( w3 >> 16 ) & 0xff]  ^ t[0][w3 >> 24];
+        buffer += 16;
+        size -= 16;
+      }
+      while ( size-- )
+        crc = ( crc >> 8 ) ^ t[0][( crc ^ *buffer++ ) & 0xff];
+      return crc;
+    }
+
+#ifdef ZIP_CRC32_PCLMUL
+    // folds 4x128 bits in parallel, then reduces with Barrett (Intel white paper
+    // "Fast CRC Computation Using PCLMULQDQ Instruction"), size >= 64 and a multiple of 16
+    __attribute__(( target( "pclmul,sse4.1" ) ))
+    static uint32_t Fold( uint32_t crc, const unsigned char *buffer, size_t size )
+    {
+      const __m128i k1k2 = _mm_set_epi64x( 0x01c6e41596LL, 0x0154442bd4LL );
+      const __m128i k3k4 = _mm_set_epi64x( 0x00ccaa009eLL, 0x01751997d0LL );
+      const __m128i k5k0 = _mm_set_epi64x( 0, 0x0163cd6124LL );
+      const __m128i pu   = _mm_set_epi64x( 0x01f7011641LL, 0x01db710641LL );
+      const __m128i mask = _mm_setr_epi32( ~0, 0, ~0, 0 );
+
+      __m128i x1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer ) );
+      __m128i x2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer + 16 ) );
+      __m128i x3 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer + 32 ) );
+      __m128i x4 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer + 48 ) );
+      x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128( crc ) );
+      buffer += 64;
+      size -= 64;
+
+      while ( size >= 64 )
+      {
+        __m128i x5 = _mm_clmulepi64_si128( x1, k1k2, 0x00 );
+        __m128i x6 = _mm_clmulepi64_si128( x2, k1k2, 0x00 );
+        __m128i x7 = _mm_clmulepi64_si128( x3, k1k2, 0x00 );
+        __m128i x8 = _mm_clmulepi64_si128( x4, k1k2, 0x00 );
+        x1 = _mm_clmulepi64_si128( x1, k1k2, 0x11 );
+        x2 = _mm_clmulepi64_si128( x2, k1k2, 0x11 );
+        x3 = _mm_clmulepi64_si128( x3, k1k2, 0x11 );
+        x4 = _mm_clmulepi64_si128( x4, k1k2, 0x11 );
+        x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer ) ) );
+        x2 = _mm_xor_si128( _mm_xor_si128( x2, x6 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer + 16 ) ) );
+        x3 = _mm_xor_si128( _mm_xor_si128( x3, x7 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer + 32 ) ) );
+        x4 = _mm_xor_si128( _mm_xor_si128( x4, x8 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer + 48 ) ) );
+        buffer += 64;
+        size -= 64;
+      }
+
+      // fold 512 bits into 128 bits
+      __m128i x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+      x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x2 ), x5 );
+      x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+      x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x3 ), x5 );
+      x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+      x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x4 ), x5 );
+
+      while ( size >= 16 )
+      {
+        x2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( buffer ) );
+        x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+        x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x2 ), x5 );
+        buffer += 16;
+        size -= 16;
+      }
+
+      // fold 128 bits into 64 bits
+      x2 = _mm_clmulepi64_si128( x1, k3k4, 0x10 );
+      x1 = _mm_xor_si128( _mm_srli_si128( x1, 8 ), x2 );
+      x2 = _mm_srli_si128( x1, 4 );
+      x1 = _mm_and_si128( x1, mask );
+      x1 = _mm_xor_si128( _mm_clmulepi64_si128( x1, k5k0, 0x00 ), x2 );
+
+      // Barrett reduction to 32 bits
+      x2 = _mm_and_si128( x1, mask );
+      x2 = _mm_clmulepi64_si128( x2, pu, 0x10 );
+      x2 = _mm_and_si128( x2, mask );
+      x2 = _mm_clmulepi64_si128( x2, pu, 0x00 );
+      x1 = _mm_xor_si128( x1, x2 );
+      return _mm_extract_epi32( x1, 1 );
+    }
+
+    static uint32_t Pclmul( uint32_t crc, const unsigned char *buffer, size_t size )
+    {
+      if ( size >= 64 )
+      {
+        size_t chunk = size & ~static_cast<size_t>( 15 );
+        crc = Fold( crc, buffer, chunk );
+        buffer += chunk;
+        size -= chunk;
+      }
+      return SliceBy16( crc, buffer, size );
+    }
+#endif
+
+    static Kernel SelectKernel()
+    {
+#ifdef ZIP_CRC32_PCLMUL
+      __builtin_cpu_init();
+      if ( __builtin_cpu_supports( "pclmul" ) && __builtin_cpu_supports( "sse4.1" ) )
+        return Pclmul;
+#endif
+      return SliceBy16;
+    }
+
+    static const uint32_t poly = 0xedb88320;
+    static const uint64_t defaultChunkSize = 64 * 1024 * 1024;
+  };
+
+  // backward search for a 4 byte record signature (little endian, as in the archive):
+  // SSE2 and AVX2 kernels test 16 and 32 positions per step, selected at runtime,
+  // with a scalar fallback
+  struct ZipSignatureScan
+  {
+    typedef ssize_t (*Kernel)( const char *buffer, size_t count, uint32_t signature );
+
+    // the last position in [0, count) where the signature starts, -1 if there is none;
+    // count + 3 bytes of buffer must be readable
+    static ssize_t FindLast( const char *buffer, size_t count, uint32_t signature )
+    {
+      static const Kernel kernel = SelectKernel();
+      return kernel( buffer, count, signature );
+    }
+
+    static ssize_t Scalar( const char *buffer, size_t count, uint32_t signature )
+    {
+      while ( count > 0 )
+      {
+        --count;
+        uint32_t value;
+        std::memcpy( &value, buffer + count, 4 );
+        if ( value == signature ) return count;
+      }
+      return -1;
+    }
+
+#ifdef ZIP_SCAN_SIMD
+    // a bit per position: each of the 4 loads (shifted by one byte) is compared with
+    // one byte of the signature, a position matches if all 4 comparisons do
+    __attribute__(( target( "sse2" ) ))
+    static ssize_t Sse2( const char *buffer, size_t count, uint32_t signature )
+    {
+      const __m128i b0 = _mm_set1_epi8( char( signature ) );
+      const __m128i b1 = _mm_set1_epi8( char( signature >> 8 ) );
+      const __m128i b2 = _mm_set1_epi8( char( signature >> 16 ) );
+      const __m128i b3 = _mm_set1_epi8( char( signature >> 24 ) );
+      while ( count >= 16 )
+      {
+        count -= 16;
+        const char *p = buffer + count;
+        __m128i m = _mm_and_si128(
+            _mm_and_si128( _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( p ) ), b0 ),
+                           _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( p + 1 ) ), b1 ) ),
+            _mm_and_si128( _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( p + 2 ) ), b2 ),
+                           _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( p + 3 ) ), b3 ) ) );
+        uint32_t mask = _mm_movemask_epi8( m );
+        if ( mask ) return count + 31 - __builtin_clz( mask );
+      }
+      return Scalar( buffer, count, signature );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    static ssize_t Avx2( const char *buffer, size_t count, uint32_t signature )
+    {
+      const __m256i b0 = _mm256_set1_epi8( char( signature ) );
+      const __m256i b1 = _mm256_set1_epi8( char( signature >> 8 ) );
+      const __m256i b2 = _mm256_set1_epi8( char( signature >> 16 ) );
+      const __m256i b3 = _mm256_set1_epi8( char( signature >> 24 ) );
+      while ( count >= 32 )
+      {
+        count -= 32;
+        const char *p = buffer + count;
+        __m256i m = _mm256_and_si256(
+            _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( p ) ), b0 ),
+                              _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( p + 1 ) ), b1 ) ),
+            _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( p + 2 ) ), b2 ),
+                              _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( p + 3 ) ), b3 ) ) );
+        uint32_t mask = _mm256_movemask_epi8( m );
+        if ( mask ) return count + 31 - __builtin_clz( mask );
+      }
+      return Sse2( buffer, count, signature );
+    }
+#endif
+
+    static Kernel SelectKernel()
+    {
+#ifdef ZIP_SCAN_SIMD
+      __builtin_cpu_init();
+      if ( __builtin_cpu_supports( "avx2" ) ) return Avx2;
+      if ( __builtin_cpu_supports( "sse2" ) ) return Sse2;
+#endif
+      return Scalar;
+    }
+  };
+
+  // pigz-style parallel deflate (compression method 8): the input is cut into blocks
+  // which are compressed concurrently on the pool, each block is primed with the last
+  // 32 KB of the previous one and ends on a sync flush (the last one on Z_FINISH), so the
+  // blocks concatenated in order form a single valid deflate stream
+  class ZipDeflater
+  {
+    public:
+
+      // receives the compressed stream in order, offset is the position in the stream
+      typedef std::function<void( const char *buffer, uint32_t size, uint64_t offset )> Output;
+
+      ZipDeflater( ZipThreadPool &pool, Output output, int level = Z_DEFAULT_COMPRESSION,
+                   uint32_t blockSize = defaultBlockSize ) : pool( pool ),
+                                                             output( output ),
+                                                             level( level ),
+                                                             blockSize( blockSize ),
+                                                             crc( 0 ),
+                                                             uncompressedSize( 0 ),
+                                                             compressedSize( 0 ),
+                                                             finished( false )
+      {
+        block.reserve( blockSize );
+      }
+
+      // compress the next chunk of input
+      void Write( const char *buffer, uint64_t size )
+      {
+        while ( size > 0 )
+        {
+          size_t chunk = std::min<uint64_t>( size, blockSize - block.size() );
+          block.insert( block.end(), buffer, buffer + chunk );
+          buffer += chunk;
+          size -= chunk;
+          if ( block.size() == blockSize ) Submit( false );
+        }
+      }
+
+      // compress the remaining input, end the stream and wait for all the output
+      void Finish()
+      {
+        if ( finished ) return;
+        Submit( true );
+        while ( !pending.empty() )
+          Drain();
+        finished = true;
+      }
+
+      // CRC-32 of the uncompressed data, valid after Finish()
+      uint32_t Crc() const
+      {
+        return crc;
+      }
+
+      uint64_t UncompressedSize() const
+      {
+        return uncompressedSize;
+      }
+
+      uint64_t CompressedSize() const
+      {
+        return compressedSize;
+      }
+
+      // upper bound of the compressed size of size bytes of input
+      static uint64_t Bound( uint64_t size, uint32_t blockSize = defaultBlockSize )
+      {
+        return size + ( size >> 12 ) + ( size >> 14 ) + ( size >> 25 ) + 32 * ( size / blockSize + 1 );
+      }
+
+      static const uint32_t defaultBlockSize = 256 * 1024;
+      static const uint16_t deflateMethod = 8;
+
+    private:
+
+      struct Block
+      {
+        std::vector<char> input;
+        std::vector<char> dictionary;
+        bool              last;
+      };
+
+      struct Result
+      {
+        std::vector<char> output;
+        uint32_t          crc;
+        uint64_t          size;
+      };
+
+      void Submit( bool last )
+      {
+        std::shared_ptr<Block> next( new Block );
+        next->input.swap( block );
+        next->dictionary.swap( dictionary );
+        next->last = last;
+        // the next block is primed with the end of this one
+        size_t dictionarySize = std::min<size_t>( next->input.size(), windowSize );
+        dictionary.assign( next->input.end() - dictionarySize, next->input.end() );
+        block.clear();
+        block.reserve( blockSize );
+
+        int lvl = level;
+        pending.push_back( pool.Submit( [next, lvl]() { return Compress( *next, lvl ); } ) );
+
+        // write whatever is ready and bound the number of blocks held in memory
+        while ( !pending.empty() && pending.front().wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready )
+          Drain();
+        while ( pending.size() > 2 * pool.Size() )
+          Drain();
+      }
+
+      void Drain()
+      {
+        Result result = pending.front().get();
+        pending.pop_front();
+        crc = ZipCrc32::Combine( crc, result.crc, result.size );
+        uncompressedSize += result.size;
+        if ( !result.output.empty() )
+          output( result.output.data(), result.output.size(), compressedSize );
+        compressedSize += result.output.size();
+      }
+
+      static Result Compress( const Block &block, int level )
+      {
+        z_stream strm;
+        std::memset( &strm, 0, sizeof( strm ) );
+        if ( deflateInit2( &strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInternal, errInternal, "Failed to initialize deflate." ), 0 );
+        if ( !block.dictionary.empty() )
+          deflateSetDictionary( &strm, reinterpret_cast<const Bytef*>( block.dictionary.data() ), block.dictionary.size() );
+
+        Result result;
+        result.output.resize( deflateBound( &strm, block.input.size() ) + 16 );
+        strm.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( block.input.data() ) );
+        strm.avail_in = block.input.size();
+        int flush = block.last ? Z_FINISH : Z_SYNC_FLUSH;
+        while ( true )
+        {
+          strm.next_out = reinterpret_cast<Bytef*>( result.output.data() + strm.total_out );
+          strm.avail_out = result.output.size() - strm.total_out;
+          int rc = deflate( &strm, flush );
+          if ( rc == Z_STREAM_ERROR )
+          {
+            deflateEnd( &strm );
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInternal, errInternal, "Deflate failed." ), 0 );
+          }
+          if ( block.last ? rc == Z_STREAM_END : strm.avail_out > 0 ) break;
+          result.output.resize( result.output.size() * 2 );
+        }
+        result.output.resize( strm.total_out );
+        deflateEnd( &strm );
+
+        result.crc = ZipCrc32::Update( 0, block.input.data(), block.input.size() );
+        result.size = block.input.size();
+        return result;
+      }
+
+      ZipThreadPool                   &pool;
+      Output                           output;
+      int                              level;
+      uint32_t                         blockSize;
+      std::vector<char>                block;
+      std::vector<char>                dictionary;
+      std::deque<std::future<Result>>  pending;
+      uint32_t                         crc;
+      uint64_t                         uncompressedSize;
+      uint64_t                         compressedSize;
+      bool                             finished;
+
+      static const uint32_t windowSize = 32 * 1024;
+  };
+
+  // ZIP64 extended information extra field
+  struct ZipExtra
+  {
+    ZipExtra( uint64_t fileSize )
+    {
+      offset = 0;
+      nbDisk = 0;
+      if ( fileSize >= ovrflw32 )
+      {
+        dataSize = 16;
+        uncompressedSize = fileSize;
+        compressedSize = fileSize;
+        totalSize = dataSize + 4;
+      }
+      else 
+      {
+        dataSize = 0;
+        uncompressedSize = 0;
+        compressedSize = 0;
+        totalSize = 0;
+      }
+    }
+
+    ZipExtra( ZipExtra *extra, uint64_t offset )
+    {
+      nbDisk = 0;
+      uncompressedSize = extra->uncompressedSize;
+      compressedSize = extra->compressedSize;
+      dataSize = extra->dataSize;
+      totalSize = extra->totalSize;
+      if ( offset >= ovrflw32 )
+      {
+        this->offset = offset;
+        dataSize += 8;
+        totalSize = dataSize + 4;
+      }
+      else
+        this->offset = 0;
+    }
+
+    // serialize totalSize bytes into buffer
+    void Serialize( char *buffer )
+    {
+      std::memcpy( buffer, &headerID, 2 );
+      std::memcpy( buffer + 2, &dataSize, 2 );
+      if ( dataSize >= 16 )
+      {
+        std::memcpy( buffer + 4, &uncompressedSize, 8 );
+        std::memcpy( buffer + 12, &compressedSize, 8 );
+        if ( offset > 0 )
+          std::memcpy( buffer + 20, &offset, 8 );
+      }
+      else if ( offset > 0 )
+        std::memcpy( buffer + 4, &offset, 8 );
+    }
+
+    template<typename IO>
+    void Write( IO &archive, uint64_t writeOffset )
+    {
+      if ( totalSize > 0 )
+      {
+        std::unique_ptr<char[]> buffer { new char[totalSize] };
+        Serialize( buffer.get() );
+        
+        XRootDStatus st =	archive.Write( writeOffset, totalSize, buffer.get() );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+      }
+    }
+
+    static const uint16_t headerID = 0x0001;
+    uint16_t dataSize;
+    uint64_t uncompressedSize;
+    uint64_t compressedSize;
+    uint64_t offset;
+    uint32_t nbDisk;
+    uint16_t totalSize;
+  };
+
+  // local file header
+  struct LFH
+  {
+    LFH( std::string filename, uint32_t crc, off_t fileSize, time_t time ) 
+    {
+      generalBitFlag = 0;
+      compressionMethod = 0;
+      ZCRC32 = crc;
+      if ( fileSize >= ovrflw32 ) 
+      {
+        compressedSize = ovrflw32;
+        uncompressedSize = ovrflw32;
+      }
+      else
+      {
+        compressedSize = fileSize;
+        uncompressedSize = fileSize;
+      }
+      extra = new ZipExtra( fileSize );
+      extraLength = extra->totalSize;    
+      if ( extraLength == 0 )
+        minZipVersion = 10;
+      else
+        minZipVersion = 45;
+      this->filename = filename;
+      filenameLength = this->filename.length();
+      
+      ToMsdosDateTime( &time );
+
+      lfhSize = lfhBaseSize + filenameLength + extraLength;
+    }
+
+    // constructor used when streaming, the crc and sizes follow the file data
+    // in a data descriptor, with a ZIP64 extra field if the file may reach 4 GB
+    LFH( std::string filename, time_t time, bool zip64 ) : LFH( filename, 0, zip64 ? ovrflw32 : 0, time )
+    {
+      generalBitFlag = dataDescriptorFlag;
+      extra->uncompressedSize = 0;
+      extra->compressedSize = 0;
+    }
+
+    ~LFH()
+    {
+      delete extra;
+    }
+
+    LFH( const LFH& ) = delete;
+    LFH& operator=( const LFH& ) = delete;
+
+    // set the final crc and sizes, which go to the ZIP64 extra field if there is one
+    void SetSizes( uint32_t crc, uint64_t compressedSize, uint64_t uncompressedSize )
+    {
+      ZCRC32 = crc;
+      if ( extraLength > 0 )
+      {
+        extra->compressedSize = compressedSize;
+        extra->uncompressedSize = uncompressedSize;
+        this->compressedSize = ovrflw32;
+        this->uncompressedSize = ovrflw32;
+      }
+      else
+      {
+        this->compressedSize = compressedSize;
+        this->uncompressedSize = uncompressedSize;
+      }
+    }
+
+    void SetCompressionMethod( uint16_t method )
+    {
+      compressionMethod = method;
+      // deflate needs v2.0 of the ZIP specification
+      if ( method == ZipDeflater::deflateMethod && minZipVersion < 20 )
+        minZipVersion = 20;
+    }
+    
+    void ToMsdosDateTime( time_t *originalTime )
+    {
+      // convert from Epoch time to local time, reentrant as LFHs are built concurrently
+      struct tm localTime;
+      struct tm *t = localtime_r( originalTime, &localTime );
+      // convert to MS-DOS time format
+      uint16_t hour = t->tm_hour;
+      uint16_t min = t->tm_min;
+      uint16_t sec = t->tm_sec / 2;
+      uint16_t year = t->tm_year - 80;
+      uint16_t month = t->tm_mon + 1;
+      uint16_t day = t->tm_mday;  
+      lastModFileTime = ( hour << 11 ) | ( min << 5 ) | sec ;
+      lastModFileDate =  ( year << 9 ) | ( month << 5 ) | day ;
+    }
+
+    // serialize lfhSize bytes (including the extra field) into buffer
+    void Serialize( char *buffer )
+    {
+      std::memcpy( buffer, &lfhSign, 4 );
+      std::memcpy( buffer + 4, &minZipVersion, 2 );
+      std::memcpy( buffer + 6, &generalBitFlag, 2 );
+      std::memcpy( buffer + 8, &compressionMethod, 2 );
+      std::memcpy( buffer + 10, &lastModFileTime, 2 );
+      std::memcpy( buffer + 12, &lastModFileDate, 2 );
+      std::memcpy( buffer + 14, &ZCRC32, 4 );
+      std::memcpy( buffer + 18, &compressedSize, 4 );
+      std::memcpy( buffer + 22, &uncompressedSize, 4 );
+      std::memcpy( buffer + 26, &filenameLength, 2 );
+      std::memcpy( buffer + 28, &extraLength, 2 );
+      std::memcpy( buffer + 30, filename.c_str(), filenameLength );
+      
+      if ( extraLength > 0 )
+        extra->Serialize( buffer + 30 + filenameLength );
+    }
+
+    template<typename IO>
+    void Write( IO &archive, uint64_t writeOffset )
+    {
+      std::unique_ptr<char[]> buffer { new char[lfhSize] };
+      Serialize( buffer.get() );
+      
+      XRootDStatus st =	archive.Write( writeOffset, lfhSize, buffer.get() );
+      if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+    }
+
+    uint16_t minZipVersion;
+    uint16_t generalBitFlag;
+    uint16_t compressionMethod;
+    uint16_t lastModFileTime;
+    uint16_t lastModFileDate;
+    uint32_t ZCRC32;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint16_t filenameLength;
+    uint16_t extraLength;
+    std::string filename;
+    ZipExtra *extra;
+    uint16_t lfhSize;
+    
+    static const uint16_t lfhBaseSize = 30;
+    static const uint32_t lfhSign = 0x04034b50;
+    static const uint16_t dataDescriptorFlag = 0x0008;
+  };
+
+  // central directory file header
+  struct CDFH
+  {
+    CDFH( LFH *lfh, mode_t mode, uint64_t lfhOffset )
+    {
+      zipVersion = ( 3 << 8 ) | 63;
+      generalBitFlag = lfh->generalBitFlag;
+      compressionMethod = lfh->compressionMethod;
+      lastModFileTime = lfh->lastModFileTime;
+      lastModFileDate = lfh->lastModFileDate;
+      ZCRC32 = lfh->ZCRC32;
+      compressedSize = lfh->compressedSize;
+      uncompressedSize = lfh->uncompressedSize;
+      filenameLength = lfh->filenameLength;
+      commentLength = 0;
+      nbDisk = 0;
+      internAttr = 0;
+      externAttr = mode << 16;
+      if ( lfhOffset >= ovrflw32 ) 
+        offset = ovrflw32;
+      else
+        offset = lfhOffset;   
+      extra = new ZipExtra( lfh->extra, lfhOffset );
+      extraLength = extra->totalSize;
+      if ( extraLength == 0 )
+        minZipVersion = 10;
+      else
+        minZipVersion = 45;
+      if ( lfh->minZipVersion > minZipVersion )
+        minZipVersion = lfh->minZipVersion;
+      filename = lfh->filename;
+      comment = "";
+      cdfhSize = cdfhBaseSize + filenameLength + extraLength + commentLength;
+    }
+
+    ~CDFH()
+    {
+      delete extra;
+    }
+
+    CDFH( const CDFH& ) = delete;
+    CDFH& operator=( const CDFH& ) = delete;
+
+    // serialize cdfhSize bytes (including the extra field and comment) into buffer
+    void Serialize( char *buffer )
+    {
+      std::memcpy( buffer, &cdfhSign, 4 );
+      std::memcpy( buffer + 4, &zipVersion, 2 );
+      std::memcpy( buffer + 6, &minZipVersion, 2 );
+      std::memcpy( buffer + 8, &generalBitFlag, 2 );
+      std::memcpy( buffer + 10, &compressionMethod, 2 );
+      std::memcpy( buffer + 12, &lastModFileTime, 2 );
+      std::memcpy( buffer + 14, &lastModFileDate, 2 );
+      std::memcpy( buffer + 16, &ZCRC32, 4 );
+      std::memcpy( buffer + 20, &compressedSize, 4 );
+      std::memcpy( buffer + 24, &uncompressedSize, 4 );
+      std::memcpy( buffer + 28, &filenameLength, 2 );
+      std::memcpy( buffer + 30, &extraLength, 2 );
+      std::memcpy( buffer + 32, &commentLength, 2 );
+      std::memcpy( buffer + 34, &nbDisk, 2 );
+      std::memcpy( buffer + 36, &internAttr, 2 );
+      std::memcpy( buffer + 38, &externAttr, 4 );
+      std::memcpy( buffer + 42, &offset, 4 );
+      std::memcpy( buffer + 46, filename.c_str(), filenameLength );
+      buffer += cdfhBaseSize + filenameLength;
+
+      if ( extraLength > 0 )
+      {
+        extra->Serialize( buffer );
+        buffer += extraLength;
+      }
+
+      if ( commentLength > 0 )
+        std::memcpy( buffer, comment.c_str(), commentLength );
+    }
+
+    template<typename IO>
+    void Write( IO &archive, uint64_t writeOffset )
+    {
+      std::unique_ptr<char[]> buffer { new char[cdfhSize] };
+      Serialize( buffer.get() );
+
+      XRootDStatus st =	archive.Write( writeOffset, cdfhSize, buffer.get() );
+      if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+    }
+
+    uint16_t zipVersion;
+    uint16_t minZipVersion;
+    uint16_t generalBitFlag;
+    uint16_t compressionMethod;
+    uint16_t lastModFileTime;
+    uint16_t lastModFileDate;
+    uint32_t ZCRC32;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint16_t filenameLength;
+    uint16_t extraLength;
+    uint16_t commentLength;
+    uint16_t nbDisk;
+    uint16_t internAttr;
+    uint32_t externAttr;
+    uint32_t offset;
+    std::string filename;
+    ZipExtra *extra;
+    std::string comment;
+    uint16_t cdfhSize;
+
+    static const uint16_t cdfhBaseSize = 46;
+    static const uint32_t cdfhSign = 0x02014b50;
+  };
+
+  // an entry of the central directory, with the values from the ZIP64 extra field resolved
+  struct ZipEntryInfo
+  {
+    ZipEntryInfo() : generalBitFlag( 0 ), compressionMethod( 0 ), lastModFileTime( 0 ), lastModFileDate( 0 ),
+                     ZCRC32( 0 ), compressedSize( 0 ), uncompressedSize( 0 ), offset( 0 ), externAttr( 0 ),
+                     filenameLength( 0 ), extraLength( 0 )
+    {
+
+    }
+
+    // decode the CDFH at the start of buffer (size bytes available),
+    // returns the size of the record or 0 if it is not a valid CDFH
+    uint32_t Parse( const char *buffer, uint64_t size )
+    {
+      uint32_t signature;
+      uint16_t commentLength;
+      if ( size < CDFH::cdfhBaseSize ) return 0;
+      std::memcpy( &signature, buffer, 4 );
+      std::memcpy( &filenameLength, buffer + 28, 2 );
+      std::memcpy( &extraLength, buffer + 30, 2 );
+      std::memcpy( &commentLength, buffer + 32, 2 );
+      uint32_t cdfhSize = CDFH::cdfhBaseSize + filenameLength + extraLength + commentLength;
+      if ( signature != CDFH::cdfhSign || cdfhSize > size ) return 0;
+
+      uint32_t size32;
+      std::memcpy( &generalBitFlag, buffer + 8, 2 );
+      std::memcpy( &compressionMethod, buffer + 10, 2 );
+      std::memcpy( &lastModFileTime, buffer + 12, 2 );
+      std::memcpy( &lastModFileDate, buffer + 14, 2 );
+      std::memcpy( &ZCRC32, buffer + 16, 4 );
+      std::memcpy( &size32, buffer + 20, 4 );
+      compressedSize = size32;
+      std::memcpy( &size32, buffer + 24, 4 );
+      uncompressedSize = size32;
+      std::memcpy( &externAttr, buffer + 38, 4 );
+      std::memcpy( &size32, buffer + 42, 4 );
+      offset = size32;
+
+      // the ZIP64 extended information holds, in this order, the values which are -1
+      const char *extra = buffer + CDFH::cdfhBaseSize + filenameLength;
+      const char *extraEnd = extra + extraLength;
+      while ( extra + 4 <= extraEnd )
+      {
+        uint16_t headerID, dataSize;
+        std::memcpy( &headerID, extra, 2 );
+        std::memcpy( &dataSize, extra + 2, 2 );
+        const char *data = extra + 4;
+        extra = data + dataSize;
+        if ( extra > extraEnd ) return 0;
+        if ( headerID != ZipExtra::headerID ) continue;
+        if ( uncompressedSize == ovrflw32 && data + 8 <= extra )
+        {
+          std::memcpy( &uncompressedSize, data, 8 );
+          data += 8;
+        }
+        if ( compressedSize == ovrflw32 && data + 8 <= extra )
+        {
+          std::memcpy( &compressedSize, data, 8 );
+          data += 8;
+        }
+        if ( offset == ovrflw32 && data + 8 <= extra )
+          std::memcpy( &offset, data, 8 );
+      }
+      return cdfhSize;
+    }
+
+    mode_t Mode() const
+    {
+      return externAttr >> 16;
+    }
+
+    uint16_t generalBitFlag;
+    uint16_t compressionMethod;
+    uint16_t lastModFileTime;
+    uint16_t lastModFileDate;
+    uint32_t ZCRC32;
+    uint64_t compressedSize;
+    uint64_t uncompressedSize;
+    uint64_t offset;
+    uint32_t externAttr;
+    uint16_t filenameLength;
+    uint16_t extraLength;
+  };
+
+  // an entry of the central directory seen in place: the name points into the central
+  // directory (it is not null terminated) and the fields are decoded into info
+  struct ZipEntryView
+  {
+    ZipEntryView() : name( 0 ), nameLength( 0 )
+    {
+
+    }
+
+    std::string Name() const
+    {
+      return std::string( name, nameLength );
+    }
+
+    const char   *name;
+    uint16_t      nameLength;
+    ZipEntryInfo  info;
+  };
+
+  // forward iterator over the records of a central directory in memory, each record is
+  // decoded in place (ZIP64 extra included), nothing is copied or allocated; throws if
+  // a record is malformed
+  class ZipCdIterator
+  {
+    public:
+
+      typedef std::forward_iterator_tag iterator_category;
+      typedef ZipEntryView              value_type;
+      typedef std::ptrdiff_t            difference_type;
+      typedef const ZipEntryView*       pointer;
+      typedef const ZipEntryView&       reference;
+
+      ZipCdIterator( const char *cd, uint64_t cdSize, uint64_t offset ) : cd( cd ),
+                                                                          cdSize( cdSize ),
+                                                                          offset( offset ),
+                                                                          recordSize( 0 )
+      {
+        Decode();
+      }
+
+      reference operator*() const
+      {
+        return view;
+      }
+
+      pointer operator->() const
+      {
+        return &view;
+      }
+
+      ZipCdIterator& operator++()
+      {
+        offset += recordSize;
+        Decode();
+        return *this;
+      }
+
+      ZipCdIterator operator++( int )
+      {
+        ZipCdIterator previous( *this );
+        ++*this;
+        return previous;
+      }
+
+      bool operator==( const ZipCdIterator &other ) const
+      {
+        return cd == other.cd && offset == other.offset;
+      }
+
+      bool operator!=( const ZipCdIterator &other ) const
+      {
+        return !( *this == other );
+      }
+
+      // offset of the record in the central directory
+      uint64_t Offset() const
+      {
+        return offset;
+      }
+
+    private:
+
+      void Decode()
+      {
+        if ( offset >= cdSize )
+        {
+          offset = cdSize;
+          return;
+        }
+        recordSize = view.info.Parse( cd + offset, cdSize - offset );
+        if ( recordSize == 0 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Malformed central directory file header." ), 0 );
+        view.name = cd + offset + CDFH::cdfhBaseSize;
+        view.nameLength = view.info.filenameLength;
+      }
+
+      const char   *cd;
+      uint64_t      cdSize;
+      uint64_t      offset;
+      uint32_t      recordSize;
+      ZipEntryView  view;
+  };
+
+  // the records of a central directory in memory, for range-based for loops
+  class ZipCdView
+  {
+    public:
+
+      ZipCdView( const char *cd, uint64_t cdSize ) : cd( cd ), cdSize( cdSize )
+      {
+
+      }
+
+      ZipCdIterator begin() const
+      {
+        return ZipCdIterator( cd, cdSize, 0 );
+      }
+
+      ZipCdIterator end() const
+      {
+        return ZipCdIterator( cd, cdSize, cdSize );
+      }
+
+    private:
+
+      const char *cd;
+      uint64_t    cdSize;
+  };
+
+  // growable array stored in fixed size blocks: growing never moves (or temporarily
+  // doubles) the elements already stored, so the memory used is the number of elements
+  // rounded up to a block
+  template<typename T>
+  class ZipColumn
+  {
+    public:
+
+      ZipColumn() : size( 0 )
+      {
+
+      }
+
+      void PushBack( const T &value )
+      {
+        if ( ( size & blockMask ) == 0 ) blocks.emplace_back( new T[blockSize] );
+        blocks.back()[size & blockMask] = value;
+        ++size;
+      }
+
+      T& operator[]( size_t i )
+      {
+        return blocks[i >> blockShift][i & blockMask];
+      }
+
+      const T& operator[]( size_t i ) const
+      {
+        return blocks[i >> blockShift][i & blockMask];
+      }
+
+      size_t Size() const
+      {
+        return size;
+      }
+
+      void Clear()
+      {
+        blocks.clear();
+        size = 0;
+      }
+
+    private:
+
+      std::vector<std::unique_ptr<T[]>> blocks;
+      size_t                            size;
+
+      static const size_t blockShift = 14;
+      static const size_t blockSize = size_t( 1 ) << blockShift;
+      static const size_t blockMask = blockSize - 1;
+  };
+
+  // central directory records of the files appended in this session, kept as columns
+  // of fixed size fields plus blocks holding the filenames back to back, so an entry
+  // costs about 50 bytes and its name with no allocation of its own, and the records
+  // are serialized straight into the output buffer when the archive is finalized
+  class ZipCdStore
+  {
+    public:
+
+      ZipCdStore() : cdSize( 0 ), nameBlockEnd( 0 ), nameBlockFree( 0 )
+      {
+
+      }
+
+      // add the CDFH of the file with the given LFH, returns the size of the record
+      uint16_t Add( const LFH &lfh, mode_t mode, uint64_t lfhOffset )
+      {
+        minZipVersion.PushBack( lfh.minZipVersion );
+        generalBitFlag.PushBack( lfh.generalBitFlag );
+        compressionMethod.PushBack( lfh.compressionMethod );
+        lastModFileTime.PushBack( lfh.lastModFileTime );
+        lastModFileDate.PushBack( lfh.lastModFileDate );
+        zip64Sizes.PushBack( lfh.extraLength > 0 );
+        ZCRC32.PushBack( 0 );
+        compressedSize.PushBack( 0 );
+        uncompressedSize.PushBack( 0 );
+        externAttr.PushBack( mode << 16 );
+        offset.PushBack( lfhOffset );
+        filename.PushBack( AddName( lfh.filename ) );
+        filenameLength.PushBack( lfh.filenameLength );
+
+        size_t i = Size() - 1;
+        Update( i, lfh );
+        uint16_t size = CdfhSize( i );
+        cdSize += size;
+        return size;
+      }
+
+      // set the crc and sizes of a file from its (final) LFH, the size of the record
+      // does not change since the LFH keeps its ZIP64 extra field (or lack thereof)
+      void Update( size_t i, const LFH &lfh )
+      {
+        ZCRC32[i] = lfh.ZCRC32;
+        compressedSize[i] = lfh.extraLength > 0 ? lfh.extra->compressedSize : lfh.compressedSize;
+        uncompressedSize[i] = lfh.extraLength > 0 ? lfh.extra->uncompressedSize : lfh.uncompressedSize;
+      }
+
+      size_t Size() const
+      {
+        return offset.Size();
+      }
+
+      // total size of the serialized records
+      uint64_t CdSize() const
+      {
+        return cdSize;
+      }
+
+      uint16_t CdfhSize( size_t i ) const
+      {
+        return CDFH::cdfhBaseSize + filenameLength[i] + ExtraLength( i );
+      }
+
+      const char* Filename( size_t i ) const
+      {
+        return filename[i];
+      }
+
+      uint16_t FilenameLength( size_t i ) const
+      {
+        return filenameLength[i];
+      }
+
+      // the i-th record as decoded from a serialized CDFH
+      void GetEntry( size_t i, ZipEntryInfo &info ) const
+      {
+        info.generalBitFlag = generalBitFlag[i];
+        info.compressionMethod = compressionMethod[i];
+        info.lastModFileTime = lastModFileTime[i];
+        info.lastModFileDate = lastModFileDate[i];
+        info.ZCRC32 = ZCRC32[i];
+        info.compressedSize = compressedSize[i];
+        info.uncompressedSize = uncompressedSize[i];
+        info.offset = offset[i];
+        info.externAttr = externAttr[i];
+        info.filenameLength = filenameLength[i];
+        info.extraLength = ExtraLength( i );
+      }
+
+      // serialize all the records into buffer, returns the end of what was written
+      char* Serialize( char *buffer ) const
+      {
+        for ( size_t i = 0; i < Size(); ++i )
+          buffer = Serialize( i, buffer );
+        return buffer;
+      }
+
+      // same bytes as CDFH::Serialize() for the CDFH built from the same LFH
+      char* Serialize( size_t i, char *buffer ) const
+      {
+        uint16_t extraLength = ExtraLength( i );
+        uint16_t version = std::max<uint16_t>( extraLength > 0 ? 45 : 10, minZipVersion[i] );
+        uint32_t compressed = zip64Sizes[i] ? ovrflw32 : compressedSize[i];
+        uint32_t uncompressed = zip64Sizes[i] ? ovrflw32 : uncompressedSize[i];
+        uint32_t lfhOffset = offset[i] >= ovrflw32 ? ovrflw32 : offset[i];
+        uint16_t zero = 0;
+
+        std::memcpy( buffer, &CDFH::cdfhSign, 4 );
+        std::memcpy( buffer + 4, &zipVersion, 2 );
+        std::memcpy( buffer + 6, &version, 2 );
+        std::memcpy( buffer + 8, &generalBitFlag[i], 2 );
+        std::memcpy( buffer + 10, &compressionMethod[i], 2 );
+        std::memcpy( buffer + 12, &lastModFileTime[i], 2 );
+        std::memcpy( buffer + 14, &lastModFileDate[i], 2 );
+        std::memcpy( buffer + 16, &ZCRC32[i], 4 );
+        std::memcpy( buffer + 20, &compressed, 4 );
+        std::memcpy( buffer + 24, &uncompressed, 4 );
+        std::memcpy( buffer + 28, &filenameLength[i], 2 );
+        std::memcpy( buffer + 30, &extraLength, 2 );
+        std::memcpy( buffer + 32, &zero, 2 );
+        std::memcpy( buffer + 34, &zero, 2 );
+        std::memcpy( buffer + 36, &zero, 2 );
+        std::memcpy( buffer + 38, &externAttr[i], 4 );
+        std::memcpy( buffer + 42, &lfhOffset, 4 );
+        std::memcpy( buffer + 46, filename[i], filenameLength[i] );
+        buffer += CDFH::cdfhBaseSize + filenameLength[i];
+
+        if ( extraLength > 0 )
+        {
+          // ZIP64 extended information: the sizes, then the offset, if they overflow
+          uint16_t dataSize = extraLength - 4;
+          std::memcpy( buffer, &ZipExtra::headerID, 2 );
+          std::memcpy( buffer + 2, &dataSize, 2 );
+          char *ptr = buffer + 4;
+          if ( zip64Sizes[i] )
+          {
+            std::memcpy( ptr, &uncompressedSize[i], 8 );
+            std::memcpy( ptr + 8, &compressedSize[i], 8 );
+            ptr += 16;
+          }
+          if ( offset[i] >= ovrflw32 )
+            std::memcpy( ptr, &offset[i], 8 );
+          buffer += extraLength;
+        }
+        return buffer;
+      }
+
+      void Clear()
+      {
+        minZipVersion.Clear();
+        generalBitFlag.Clear();
+        compressionMethod.Clear();
+        lastModFileTime.Clear();
+        lastModFileDate.Clear();
+        zip64Sizes.Clear();
+        ZCRC32.Clear();
+        compressedSize.Clear();
+        uncompressedSize.Clear();
+        externAttr.Clear();
+        offset.Clear();
+        filename.Clear();
+        filenameLength.Clear();
+        nameBlocks.clear();
+        nameBlockFree = 0;
+        cdSize = 0;
+      }
+
+    private:
+
+      uint16_t ExtraLength( size_t i ) const
+      {
+        uint16_t dataSize = ( zip64Sizes[i] ? 16 : 0 ) + ( offset[i] >= ovrflw32 ? 8 : 0 );
+        return dataSize > 0 ? dataSize + 4 : 0;
+      }
+
+      // copy a filename to the name blocks, which are never moved either
+      const char* AddName( const std::string &name )
+      {
+        if ( name.size() > nameBlockFree )
+        {
+          nameBlockFree = std::max( size_t( nameBlockSize ), name.size() );
+          nameBlocks.emplace_back( new char[nameBlockFree] );
+          nameBlockEnd = nameBlocks.back().get();
+        }
+        char *ptr = nameBlockEnd;
+        std::memcpy( ptr, name.data(), name.size() );
+        nameBlockEnd += name.size();
+        nameBlockFree -= name.size();
+        return ptr;
+      }
+
+      ZipColumn<uint16_t>     minZipVersion;
+      ZipColumn<uint16_t>     generalBitFlag;
+      ZipColumn<uint16_t>     compressionMethod;
+      ZipColumn<uint16_t>     lastModFileTime;
+      ZipColumn<uint16_t>     lastModFileDate;
+      ZipColumn<uint8_t>      zip64Sizes;
+      ZipColumn<uint32_t>     ZCRC32;
+      ZipColumn<uint64_t>     compressedSize;
+      ZipColumn<uint64_t>     uncompressedSize;
+      ZipColumn<uint32_t>     externAttr;
+      ZipColumn<uint64_t>     offset;
+      ZipColumn<const char*>  filename;
+      ZipColumn<uint16_t>     filenameLength;
+      uint64_t                cdSize;
+      std::vector<std::unique_ptr<char[]>> nameBlocks;
+      char                   *nameBlockEnd;
+      size_t                  nameBlockFree;
+
+      static const uint16_t zipVersion = ( 3 << 8 ) | 63;
+      static const size_t   nameBlockSize = 1024 * 1024;
+  };
+
+  // open addressing (linear probing) hash table from filename to central directory entry,
+  // covering both the central directory read from the archive (cd) and the files appended
+  // since (store); the table only holds the hash and the location of each entry, names are
+  // compared and entries decoded in place, so the index costs 16 bytes per slot
+  // if a name appears more than once the last entry wins, as for most readers
+  // the table of the central directory can also be one built earlier and mapped from a
+  // sidecar file (see ZipIndexFile), it is then left as is and only the files appended
+  // since go to a table of their own, which is looked up first; a slot of the mapped
+  // table which does not point to a record within the central directory is skipped
+  class ZipCdIndex
+  {
+    public:
+
+      struct Slot
+      {
+        uint32_t tag;
+        uint32_t reserved;
+        uint64_t location;
+      };
+
+      // throws if the central directory is malformed
+      // with a pool, the central directory is cut in chunks decoded concurrently (see Parse())
+      ZipCdIndex( const char *cd, uint64_t cdSize, uint64_t nbRecords, const ZipCdStore &store,
+                  ZipThreadPool *pool = 0 ) : cd( cd ),
+                                              cdSize( cdSize ),
+                                              store( store ),
+                                              base( 0 ),
+                                              baseMask( 0 ),
+                                              baseCount( 0 ),
+                                              count( 0 ),
+                                              shadowed( 0 )
+      {
+        Reserve( nbRecords + store.Size() );
+        std::vector<Chunk> chunks = Parse( cdSize, pool );
+        for ( size_t i = 0; i < chunks.size(); ++i )
+          for ( size_t j = 0; j < chunks[i].locations.size(); ++j )
+            Insert( chunks[i].locations[j], chunks[i].hashes[j] );
+        for ( size_t i = 0; i < store.Size(); ++i )
+          AddPending( i );
+      }
+
+      // on top of a table built for cd (cdSize bytes) by an other index (capacity slots,
+      // a power of 2, holding nbEntries names), the table is used in place and must outlive
+      // the index
+      ZipCdIndex( const char *cd, uint64_t cdSize, const Slot *baseSlots, size_t capacity, uint64_t nbEntries,
+                  const ZipCdStore &store ) : cd( cd ),
+                                              cdSize( cdSize ),
+                                              store( store ),
+                                              base( baseSlots ),
+                                              baseMask( capacity - 1 ),
+                                              baseCount( nbEntries ),
+                                              count( 0 ),
+                                              shadowed( 0 )
+      {
+        Reserve( store.Size() );
+        for ( size_t i = 0; i < store.Size(); ++i )
+          AddPending( i );
+      }
+
+      // index the i-th file appended in this session
+      void AddPending( size_t i )
+      {
+        Insert( pendingFlag | i );
+      }
+
+      bool Find( const std::string &filename, ZipEntryInfo &info ) const
+      {
+        uint64_t hash = Hash( filename.data(), filename.size() );
+        const Slot *slot = Probe( slots.data(), mask, hash, filename.data(), filename.size() );
+        if ( !slot && base ) slot = Probe( base, baseMask, hash, filename.data(), filename.size() );
+        if ( !slot ) return false;
+        if ( slot->location & pendingFlag )
+          store.GetEntry( slot->location & ~pendingFlag, info );
+        else if ( info.Parse( cd + slot->location, cdSize - slot->location ) == 0 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Malformed central directory file header." ), 0 );
+        return true;
+      }
+
+      bool Contains( const std::string &filename ) const
+      {
+        ZipEntryInfo info;
+        return Find( filename, info );
+      }
+
+      // number of distinct names
+      size_t Size() const
+      {
+        return baseCount + count - shadowed;
+      }
+
+      // the table of the index built by the first constructor, to be saved with ZipIndexFile
+      const Slot* Slots() const
+      {
+        return slots.data();
+      }
+
+      size_t Capacity() const
+      {
+        return slots.size();
+      }
+
+    private:
+
+      // records of a part of the central directory: where they are and the hash of their names
+      struct Chunk
+      {
+        Chunk() : begin( 0 ), end( 0 ), ok( true )
+        {
+
+        }
+
+        uint64_t              begin;
+        uint64_t              end;
+        bool                  ok;
+        std::vector<uint64_t> locations;
+        std::vector<uint64_t> hashes;
+      };
+
+      // decode the records of the central directory: with a pool, it is cut at arbitrary
+      // offsets, each chunk is resynchronized on the first CDFH signature which starts a
+      // valid record followed by an other one (or by the end), and the chunks are decoded
+      // concurrently; they are then stitched in order: a chunk whose first record is not
+      // where the previous one ended (a signature in a name or an extra field fooled the
+      // resynchronization) is decoded again from there, so the result is always the one
+      // of a sequential walk
+      std::vector<Chunk> Parse( uint64_t cdSize, ZipThreadPool *pool ) const
+      {
+        size_t nbChunks = pool ? std::max( uint64_t( 1 ), std::min( uint64_t( pool->Size() ) * 4, cdSize / minChunkSize ) ) : 1;
+        std::vector<Chunk> chunks( nbChunks );
+        std::vector<uint64_t> limits( nbChunks + 1 );
+        for ( size_t i = 0; i <= nbChunks; ++i )
+          limits[i] = cdSize / nbChunks * i;
+        limits[nbChunks] = cdSize;
+
+        if ( nbChunks == 1 )
+          Walk( 0, cdSize, cdSize, chunks[0] );
+        else
+        {
+          std::vector<std::future<void>> tasks;
+          for ( size_t i = 0; i < nbChunks; ++i )
+          {
+            Chunk *chunk = &chunks[i];
+            uint64_t begin = limits[i], limit = limits[i + 1];
+            tasks.push_back( pool->Submit( [this, chunk, begin, limit, cdSize]()
+            {
+              uint64_t start = begin == 0 ? 0 : Resync( begin, limit, cdSize );
+              Walk( start, limit, cdSize, *chunk );
+            } ) );
+          }
+          for ( size_t i = 0; i < tasks.size(); ++i )
+            tasks[i].get();
+        }
+
+        for ( size_t i = 0; i < nbChunks; ++i )
+        {
+          if ( i > 0 && ( chunks[i].begin != chunks[i - 1].end || !chunks[i].ok ) )
+          {
+            chunks[i] = Chunk();
+            Walk( chunks[i - 1].end, limits[i + 1], cdSize, chunks[i] );
+          }
+          if ( !chunks[i].ok )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Malformed central directory file header." ), 0 );
+        }
+        return chunks;
+      }
+
+      // decode the records starting from offset up to the first one starting at or after limit
+      void Walk( uint64_t offset, uint64_t limit, uint64_t cdSize, Chunk &chunk ) const
+      {
+        chunk.begin = offset;
+        ZipEntryInfo info;
+        while ( offset < limit )
+        {
+          uint32_t size = info.Parse( cd + offset, cdSize - offset );
+          if ( size == 0 )
+          {
+            chunk.ok = false;
+            break;
+          }
+          chunk.locations.push_back( offset );
+          chunk.hashes.push_back( Hash( cd + offset + CDFH::cdfhBaseSize, info.filenameLength ) );
+          offset += size;
+        }
+        chunk.end = offset;
+      }
+
+      // the first offset in [begin, limit) where a valid record starts and is followed by
+      // a valid record or by the end of the central directory, limit if there is none
+      uint64_t Resync( uint64_t begin, uint64_t limit, uint64_t cdSize ) const
+      {
+        ZipEntryInfo info;
+        for ( uint64_t offset = begin; offset < limit; ++offset )
+        {
+          uint32_t signature;
+          if ( cdSize - offset < 4 ) break;
+          std::memcpy( &signature, cd + offset, 4 );
+          if ( signature != CDFH::cdfhSign ) continue;
+          uint32_t size = info.Parse( cd + offset, cdSize - offset );
+          if ( size == 0 ) continue;
+          if ( offset + size == cdSize || info.Parse( cd + offset + size, cdSize - offset - size ) != 0 ) return offset;
+        }
+        return limit;
+      }
+
+      // at most one pass over the table, so that a mapped table without an empty slot
+      // cannot make it loop
+      const Slot* Probe( const Slot *table, size_t tableMask, uint64_t hash, const char *filename, size_t length ) const
+      {
+        uint32_t tag = hash >> 32;
+        size_t slot = hash & tableMask;
+        for ( size_t n = 0; n <= tableMask && table[slot].location != empty; ++n, slot = ( slot + 1 ) & tableMask )
+        {
+          if ( table[slot].tag != tag ) continue;
+          const char *name;
+          uint16_t nameLength;
+          if ( table == base && !InCd( table[slot].location ) ) continue;
+          Name( table[slot].location, name, nameLength );
+          if ( nameLength == length && std::memcmp( name, filename, nameLength ) == 0 ) return table + slot;
+        }
+        return 0;
+      }
+
+      // FNV-1a, the high bits are kept in the slot to skip most name comparisons
+      static uint64_t Hash( const char *name, size_t length )
+      {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for ( size_t i = 0; i < length; ++i )
+        {
+          hash ^= uint8_t( name[i] );
+          hash *= 0x100000001b3ULL;
+        }
+        return hash;
+      }
+
+      void Name( uint64_t location, const char *&name, uint16_t &nameLength ) const
+      {
+        if ( location & pendingFlag )
+        {
+          name = store.Filename( location & ~pendingFlag );
+          nameLength = store.FilenameLength( location & ~pendingFlag );
+        }
+        else
+        {
+          name = cd + location + CDFH::cdfhBaseSize;
+          std::memcpy( &nameLength, cd + location + 28, 2 );
+        }
+      }
+
+      // whether the fixed part and the name of the record at location are within the
+      // central directory, for the slots of a mapped table
+      bool InCd( uint64_t location ) const
+      {
+        if ( location >= cdSize || cdSize - location < CDFH::cdfhBaseSize ) return false;
+        uint16_t nameLength;
+        std::memcpy( &nameLength, cd + location + 28, 2 );
+        return cdSize - location - CDFH::cdfhBaseSize >= nameLength;
+      }
+
+      // keep the load factor under 1/2
+      void Reserve( uint64_t nbEntries )
+      {
+        size_t capacity = 16;
+        while ( capacity < 2 * nbEntries ) capacity *= 2;
+        if ( capacity <= slots.size() ) return;
+
+        std::vector<Slot> old( capacity, Slot{ 0, 0, empty } );
+        old.swap( slots );
+        mask = capacity - 1;
+        count = 0;
+        shadowed = 0;
+        for ( size_t i = 0; i < old.size(); ++i )
+          if ( old[i].location != empty ) Insert( old[i].location );
+      }
+
+      void Insert( uint64_t location )
+      {
+        const char *name;
+        uint16_t nameLength;
+        Name( location, name, nameLength );
+        Insert( location, Hash( name, nameLength ) );
+      }
+
+      void Insert( uint64_t location, uint64_t hash )
+      {
+        if ( 2 * ( count + 1 ) > slots.size() ) Reserve( count + 1 );
+
+        const char *name;
+        uint16_t nameLength;
+        Name( location, name, nameLength );
+        uint32_t tag = hash >> 32;
+        size_t slot = hash & mask;
+        for ( ; slots[slot].location != empty; slot = ( slot + 1 ) & mask )
+        {
+          if ( slots[slot].tag != tag ) continue;
+          const char *other;
+          uint16_t otherLength;
+          Name( slots[slot].location, other, otherLength );
+          if ( otherLength == nameLength && std::memcmp( other, name, nameLength ) == 0 ) break;
+        }
+        if ( slots[slot].location == empty )
+        {
+          ++count;
+          if ( base && Probe( base, baseMask, hash, name, nameLength ) ) ++shadowed;
+        }
+        slots[slot].tag = tag;
+        slots[slot].location = location;
+      }
+
+      const char        *cd;
+      uint64_t           cdSize;
+      const ZipCdStore  &store;
+      std::vector<Slot>  slots;
+      size_t             mask;
+      const Slot        *base;
+      size_t             baseMask;
+      size_t             baseCount;
+      size_t             count;
+      size_t             shadowed;
+
+      static const uint64_t pendingFlag = 1ULL << 63;
+      static const uint64_t empty = ~0ULL;
+      static const uint64_t minChunkSize = 1024 * 1024;
+  };
+
+  // sidecar index of an archive (see ZipArchiveEngine::SetIndexFile()), laid out to be
+  // used in place once mapped: a header, the hash table of a ZipCdIndex and a copy of the
+  // central directory it points into; the header stamps it with the archive size, the
+  // location, size and number of records of the central directory and the CRC-32s of
+  // the table and of the central directory
+  class ZipIndexFile
+  {
+    public:
+
+      struct Header
+      {
+        char     magic[8];
+        uint64_t archiveSize;
+        uint64_t cdOffset;
+        uint64_t cdSize;
+        uint64_t nbCdRec;
+        uint64_t nbEntries;
+        uint64_t capacity;
+        uint32_t cdCrc;
+        uint32_t slotsCrc;
+      };
+
+      ZipIndexFile() : data( 0 ), size( 0 )
+      {
+
+      }
+
+      ~ZipIndexFile()
+      {
+        if ( data ) munmap( data, size );
+      }
+
+      ZipIndexFile( const ZipIndexFile& ) = delete;
+      ZipIndexFile& operator=( const ZipIndexFile& ) = delete;
+
+      // index the central directory cd (cdSize bytes at cdOffset in an archive of
+      // archiveSize bytes) into path, through a temporary file renamed over it so that
+      // a reader never maps a partial index
+      static void Write( const std::string &path, uint64_t archiveSize, uint64_t cdOffset,
+                         const char *cd, uint64_t cdSize, uint64_t nbCdRec )
+      {
+        ZipCdStore none;
+        ZipCdIndex index( cd, cdSize, nbCdRec, none );
+
+        Header header;
+        std::memset( &header, 0, sizeof( header ) );
+        std::memcpy( header.magic, Magic(), sizeof( header.magic ) );
+        header.archiveSize = archiveSize;
+        header.cdOffset    = cdOffset;
+        header.cdSize      = cdSize;
+        header.nbCdRec     = nbCdRec;
+        header.nbEntries   = index.Size();
+        header.capacity    = index.Capacity();
+        header.cdCrc       = ZipCrc32::Update( 0, cd, cdSize );
+        header.slotsCrc    = ZipCrc32::Update( 0, reinterpret_cast<const char*>( index.Slots() ), index.Capacity() * sizeof( ZipCdIndex::Slot ) );
+
+        std::string tmpPath = path + ".tmp" + std::to_string( getpid() );
+        int fd = open( tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        if ( fd == -1 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to create index file." ), 0 );
+        bool ok = WriteAll( fd, reinterpret_cast<const char*>( &header ), sizeof( header ) ) &&
+                  WriteAll( fd, reinterpret_cast<const char*>( index.Slots() ), index.Capacity() * sizeof( ZipCdIndex::Slot ) ) &&
+                  WriteAll( fd, cd, cdSize );
+        int error = errno;
+        if ( close( fd ) == -1 && ok )
+        {
+          ok = false;
+          error = errno;
+        }
+        if ( ok && rename( tmpPath.c_str(), path.c_str() ) == -1 )
+        {
+          ok = false;
+          error = errno;
+        }
+        if ( !ok )
+        {
+          unlink( tmpPath.c_str() );
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, error, "Failed to write index file." ), 0 );
+        }
+      }
+
+      // map the index at path, false if there is none or if it does not match the central
+      // directory of the archive as found in its EOCD records
+      bool Map( const std::string &path, uint64_t archiveSize, uint64_t cdOffset, uint64_t cdSize, uint64_t nbCdRec )
+      {
+        int fd = open( path.c_str(), O_RDONLY );
+        if ( fd == -1 ) return false;
+        struct stat fileInfo;
+        void *mapped = MAP_FAILED;
+        if ( fstat( fd, &fileInfo ) == 0 && uint64_t( fileInfo.st_size ) >= sizeof( Header ) )
+          mapped = mmap( 0, fileInfo.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        close( fd );
+        if ( mapped == MAP_FAILED ) return false;
+        data = static_cast<char*>( mapped );
+        size = fileInfo.st_size;
+
+        const Header *header = reinterpret_cast<const Header*>( data );
+        bool valid = std::memcmp( header->magic, Magic(), sizeof( header->magic ) ) == 0 &&
+                     header->archiveSize == archiveSize && header->cdOffset == cdOffset &&
+                     header->cdSize == cdSize && header->nbCdRec == nbCdRec &&
+                     header->capacity > 0 && ( header->capacity & ( header->capacity - 1 ) ) == 0 &&
+                     header->capacity < size / sizeof( ZipCdIndex::Slot ) &&
+                     header->nbEntries <= header->capacity &&
+                     size == sizeof( Header ) + header->capacity * sizeof( ZipCdIndex::Slot ) + cdSize &&
+                     ZipCrc32::Update( 0, reinterpret_cast<const char*>( Slots() ), header->capacity * sizeof( ZipCdIndex::Slot ) ) == header->slotsCrc &&
+                     ZipCrc32::Update( 0, Cd(), cdSize ) == header->cdCrc;
+        if ( !valid )
+        {
+          munmap( data, size );
+          data = 0;
+          size = 0;
+        }
+        return valid;
+      }
+
+      const ZipCdIndex::Slot* Slots() const
+      {
+        return reinterpret_cast<const ZipCdIndex::Slot*>( data + sizeof( Header ) );
+      }
+
+      size_t Capacity() const
+      {
+        return reinterpret_cast<const Header*>( data )->capacity;
+      }
+
+      uint64_t NbEntries() const
+      {
+        return reinterpret_cast<const Header*>( data )->nbEntries;
+      }
+
+      uint64_t CdSize() const
+      {
+        return reinterpret_cast<const Header*>( data )->cdSize;
+      }
+
+      const char* Cd() const
+      {
+        return data + sizeof( Header ) + Capacity() * sizeof( ZipCdIndex::Slot );
+      }
+
+    private:
+
+      static bool WriteAll( int fd, const char *buffer, uint64_t size )
+      {
+        while ( size > 0 )
+        {
+          ssize_t n = write( fd, buffer, size );
+          if ( n == -1 && errno == EINTR ) continue;
+          if ( n <= 0 ) return false;
+          buffer += n;
+          size -= n;
+        }
+        return true;
+      }
+
+      char     *data;
+      uint64_t  size;
+
+      static const char* Magic()
+      {
+        return "ZIPIDX02";
+      }
+  };
+
+  // end of central directory record
+  struct EOCD
+  {
+    // constructor used when reading from existing ZIP archive
+    EOCD( const char *buffer )
+    {
+      nbDisk        = *reinterpret_cast<const uint16_t*>( buffer + 4 );
+      nbDiskCd      = *reinterpret_cast<const uint16_t*>( buffer + 6 );
+      nbCdRecD      = *reinterpret_cast<const uint16_t*>( buffer + 8 );
+      nbCdRec       = *reinterpret_cast<const uint16_t*>( buffer + 10 );
+      cdSize        = *reinterpret_cast<const uint32_t*>( buffer + 12 );
+      cdOffset      = *reinterpret_cast<const uint32_t*>( buffer + 16 );
+      commentLength = *reinterpret_cast<const uint16_t*>( buffer + 20 );
+      comment       = std::string( buffer + 22, commentLength );
+
+      eocdSize = eocdBaseSize + commentLength;
+      useZip64= false;
+    }
+
+    // constructor used when the totals of the central directory are known,
+    // values that do not fit are set to -1 and must go to the ZIP64 EOCD
+    EOCD( uint64_t nbRecords, uint64_t cdSize, uint64_t cdOffset )
+    {
+      nbDisk = 0;
+      nbDiskCd = 0;
+      useZip64 = nbRecords >= ovrflw16 || cdSize >= ovrflw32 || cdOffset >= ovrflw32;
+      nbCdRecD = nbRecords >= ovrflw16 ? ovrflw16 : nbRecords;
+      nbCdRec = nbCdRecD;
+      this->cdSize = useZip64 ? ovrflw32 : cdSize;
+      this->cdOffset = useZip64 ? ovrflw32 : cdOffset;
+      commentLength = 0;
+      comment = "";
+      eocdSize = eocdBaseSize + commentLength;
+    }
+
+    // serialize eocdSize bytes into buffer
+    void Serialize( char *buffer )
+    {
+      std::memcpy( buffer, &eocdSign, 4 ); 
+      std::memcpy( buffer + 4, &nbDisk, 2 );
+      std::memcpy( buffer + 6, &nbDiskCd, 2 ); 
+      std::memcpy( buffer + 8, &nbCdRecD, 2 ); 
+      std::memcpy( buffer + 10, &nbCdRec, 2 ); 
+      std::memcpy( buffer + 12, &cdSize, 4 ); 
+      std::memcpy( buffer + 16, &cdOffset, 4 ); 
+      std::memcpy( buffer + 20, &commentLength, 2 ); 
+      
+      if ( commentLength > 0 )
+        std::memcpy( buffer + 22, comment.c_str(), commentLength ); 
+    }
+
+    template<typename IO>
+    void Write( IO &archive, uint64_t writeOffset )
+    {
+      std::unique_ptr<char[]> buffer { new char[eocdSize] };
+      Serialize( buffer.get() );
+
+      XRootDStatus st =	archive.Write( writeOffset, eocdSize, buffer.get() );
+      if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+    }
+
+    // sanity checks of a candidate EOCD found at eocdOffset in the archive: the central
+    // directory must end before it and be large enough for its records (fields set to -1
+    // are in the ZIP64 EOCD and checked when the central directory is read)
+    static bool IsValid( const char *buffer, uint64_t eocdOffset )
+    {
+      uint16_t nbCdRec;
+      uint32_t cdSize, cdOffset;
+      std::memcpy( &nbCdRec, buffer + 10, 2 );
+      std::memcpy( &cdSize, buffer + 12, 4 );
+      std::memcpy( &cdOffset, buffer + 16, 4 );
+      if ( nbCdRec != ovrflw16 && cdSize != ovrflw32 && uint64_t( nbCdRec ) * CDFH::cdfhBaseSize > cdSize ) return false;
+      if ( cdSize != ovrflw32 && cdOffset != ovrflw32 && uint64_t( cdOffset ) + cdSize > eocdOffset ) return false;
+      return true;
+    }
+
+    uint16_t nbDisk;
+    uint16_t nbDiskCd;
+    uint16_t nbCdRecD;
+    uint16_t nbCdRec;
+    uint32_t cdSize;
+    uint32_t cdOffset;
+    uint16_t commentLength;
+    std::string comment;
+    uint16_t eocdSize;
+    bool useZip64;
+
+    static const uint16_t eocdBaseSize = 22;
+    static const uint32_t eocdSign = 0x06054b50;
+    static const uint16_t maxCommentLength = 65535;
+  };
+
+  // ZIP64 end of central directory record
+  struct ZIP64_EOCD
+  {
+    // constructor used when reading from existing ZIP archive
+    ZIP64_EOCD( const char* buffer )
+    {
+      zip64EocdSize = *reinterpret_cast<const uint64_t*>( buffer + 4 );
+      zipVersion    = *reinterpret_cast<const uint16_t*>( buffer + 12 );
+      minZipVersion = *reinterpret_cast<const uint16_t*>( buffer + 14 );
+      nbDisk        = *reinterpret_cast<const uint32_t*>( buffer + 16 );
+      nbDiskCd      = *reinterpret_cast<const uint32_t*>( buffer + 20 );
+      nbCdRecD      = *reinterpret_cast<const uint64_t*>( buffer + 24 );
+      nbCdRec       = *reinterpret_cast<const uint64_t*>( buffer + 32 );
+      cdSize        = *reinterpret_cast<const uint64_t*>( buffer + 40 );
+      cdOffset      = *reinterpret_cast<const uint64_t*>( buffer + 48 );
+
+      extensibleData = "";
+      extensibleDataLength = 0;
+      zip64EocdTotalSize = zip64EocdBaseSize + extensibleDataLength;
+    }
+
+    // constructor used when the totals of the central directory are known
+    ZIP64_EOCD( uint64_t nbRecords, uint64_t cdSize, uint64_t cdOffset )
+    {
+      zipVersion = ( 3 << 8 ) | 63;
+      minZipVersion = 45;
+      nbDisk = 0;
+      nbDiskCd = 0;
+      nbCdRecD = nbRecords;
+      nbCdRec = nbRecords;
+      this->cdSize = cdSize;
+      this->cdOffset = cdOffset;
+      extensibleData = "";
+      extensibleDataLength = 0;
+      zip64EocdSize = zip64EocdBaseSize + extensibleDataLength - 12;
+      zip64EocdTotalSize = zip64EocdBaseSize + extensibleDataLength;
+    }
+
+    // serialize zip64EocdTotalSize bytes into buffer
+    void Serialize( char *buffer )
+    {
+      std::memcpy( buffer, &zip64EocdSign, 4 );
+      std::memcpy( buffer + 4, &zip64EocdSize, 8 );
+      std::memcpy( buffer + 12, &zipVersion, 2 );
+      std::memcpy( buffer + 14, &minZipVersion, 2 );
+      std::memcpy( buffer + 16, &nbDisk, 4 );
+      std::memcpy( buffer + 20, &nbDiskCd, 4 );
+      std::memcpy( buffer + 24, &nbCdRecD, 8 );
+      std::memcpy( buffer + 32, &nbCdRec, 8 );
+      std::memcpy( buffer + 40, &cdSize, 8 );
+      std::memcpy( buffer + 48, &cdOffset, 8 );
+
+      if ( extensibleDataLength > 0 )
+        std::memcpy( buffer + 56, extensibleData.c_str(), extensibleDataLength );
+    }
+
+    template<typename IO>
+    void Write( IO &archive, uint64_t writeOffset )
+    {
+      std::unique_ptr<char[]> buffer { new char[zip64EocdTotalSize] };
+      Serialize( buffer.get() );
+
+      XRootDStatus st =	archive.Write( writeOffset, zip64EocdTotalSize, buffer.get() );
+      if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+    }
+
+    uint64_t zip64EocdSize;
+    uint16_t zipVersion;
+    uint16_t minZipVersion;
+    uint32_t nbDisk;
+    uint32_t nbDiskCd;
+    uint64_t nbCdRecD;
+    uint64_t nbCdRec;
+    uint64_t cdSize;
+    uint64_t cdOffset;
+    std::string extensibleData;
+    uint64_t extensibleDataLength;
+    uint64_t zip64EocdTotalSize;
+
+    static const uint16_t zip64EocdBaseSize = 56;
+    static const uint32_t zip64EocdSign = 0x06064b50;
+  };
+
+  // ZIP64 end of central directory locator
+  struct ZIP64_EOCDL
+  {
+    // constructor used when reading from existing ZIP archive
+    ZIP64_EOCDL( const char *buffer )
+    {
+      nbDiskZip64Eocd = *reinterpret_cast<const uint32_t*>( buffer + 4 );
+      zip64EocdOffset = *reinterpret_cast<const uint64_t*>( buffer + 8 );
+      totalNbDisks    = *reinterpret_cast<const uint32_t*>( buffer + 16 );
+    }
+
+    // constructor used when creating new ZIP archive
+    ZIP64_EOCDL( uint64_t zip64EocdOffset )
+    {
+      nbDiskZip64Eocd = 0;
+      totalNbDisks = 1;
+      this->zip64EocdOffset = zip64EocdOffset;
+    }
+
+    // serialize zip64EocdlSize bytes into buffer
+    void Serialize( char *buffer )
+    {
+      std::memcpy( buffer, &zip64EocdlSign, 4 );
+      std::memcpy( buffer + 4, &nbDiskZip64Eocd, 4 );
+      std::memcpy( buffer + 8, &zip64EocdOffset, 8 );
+      std::memcpy( buffer + 16, &totalNbDisks, 4 );
+    }
+
+    template<typename IO>
+    void Write( IO &archive, uint64_t writeOffset )
+    {
+      std::unique_ptr<char[]> buffer { new char[zip64EocdlSize] };
+      Serialize( buffer.get() );
+
+      XRootDStatus st =	archive.Write( writeOffset, zip64EocdlSize, buffer.get() );
+      if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+    }
+    
+    uint32_t nbDiskZip64Eocd;
+    uint64_t zip64EocdOffset;
+    uint32_t totalNbDisks;
+
+    static const uint16_t zip64EocdlSize = 20;
+    static const uint32_t zip64EocdlSign = 0x07064b50;
+  };
+
+  // data descriptor, follows the file data if bit 3 of the general purpose flag is set
+  // sizes are 8 bytes long if the LFH has a ZIP64 extra field, 4 bytes long otherwise
+  struct DataDescriptor
+  {
+    DataDescriptor( uint32_t crc, uint64_t compressedSize, uint64_t uncompressedSize, bool zip64 )
+    {
+      ZCRC32 = crc;
+      this->compressedSize = compressedSize;
+      this->uncompressedSize = uncompressedSize;
+      this->zip64 = zip64;
+      ddSize = zip64 ? 24 : 16;
+    }
+
+    // serialize ddSize bytes into buffer
+    void Serialize( char *buffer )
+    {
+      std::memcpy( buffer, &ddSign, 4 );
+      std::memcpy( buffer + 4, &ZCRC32, 4 );
+      if ( zip64 )
+      {
+        std::memcpy( buffer + 8, &compressedSize, 8 );
+        std::memcpy( buffer + 16, &uncompressedSize, 8 );
+      }
+      else
+      {
+        uint32_t size32 = compressedSize;
+        std::memcpy( buffer + 8, &size32, 4 );
+        size32 = uncompressedSize;
+        std::memcpy( buffer + 12, &size32, 4 );
+      }
+    }
+
+    uint32_t ZCRC32;
+    uint64_t compressedSize;
+    uint64_t uncompressedSize;
+    bool     zip64;
+    uint16_t ddSize;
+
+    static const uint32_t ddSign = 0x08074b50;
+  };
+
+  // pipelined writes to the archive: the data is copied into one of a bounded pool
+  // of buffers and sent with the handler-based IO::Write, so up to maxInFlight writes
+  // are on the wire at once; when all buffers are in flight the caller waits for one to
+  // come back (backpressure); contiguous writes are coalesced into the same buffer
+  // the first error is kept and thrown by the next Write() or Flush()
+  template<typename IO>
+  class ZipAsyncWriter
+  {
+    public:
+
+      ZipAsyncWriter( IO &archive, unsigned maxInFlight, uint32_t bufferSize ) : archive( archive ),
+                                                                                 maxInFlight( std::max( maxInFlight, 1u ) ),
+                                                                                 bufferSize( bufferSize ),
+                                                                                 inFlight( 0 ),
+                                                                                 failed( false ),
+                                                                                 current( 0 ),
+                                                                                 currentOffset( 0 ),
+                                                                                 currentSize( 0 )
+      {
+
+      }
+
+      // the buffers cannot be released while the server may still read them
+      ~ZipAsyncWriter()
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        done.wait( lock, [this]{ return inFlight == 0; } );
+      }
+
+      ZipAsyncWriter( const ZipAsyncWriter& ) = delete;
+      ZipAsyncWriter& operator=( const ZipAsyncWriter& ) = delete;
+
+      // the data is copied, the caller may reuse its buffer as soon as Write() returns
+      void Write( uint64_t offset, const char *data, uint32_t size )
+      {
+        while ( size > 0 )
+        {
+          if ( current && offset != currentOffset + currentSize ) Submit();
+          if ( !current )
+          {
+            current = Acquire();
+            currentOffset = offset;
+            currentSize = 0;
+          }
+          uint32_t chunk = std::min( size, bufferSize - currentSize );
+          std::memcpy( current + currentSize, data, chunk );
+          currentSize += chunk;
+          offset += chunk;
+          data += chunk;
+          size -= chunk;
+          if ( currentSize == bufferSize ) Submit();
+        }
+      }
+
+      // send the partially filled buffer and wait for all the writes to complete
+      void Flush()
+      {
+        if ( current ) Submit();
+        std::unique_lock<std::mutex> lock( mutex );
+        done.wait( lock, [this]{ return inFlight == 0; } );
+        if ( failed ) throw ZipHandlerException<AnyObject>( new XRootDStatus( error ), 0 );
+      }
+
+    private:
+
+      // deletes itself once the write is complete, as XrdCl expects
+      struct WriteHandler : public ResponseHandler
+      {
+        WriteHandler( ZipAsyncWriter *writer, char *buffer ) : writer( writer ), buffer( buffer )
+        {
+
+        }
+
+        void HandleResponse( XRootDStatus *status, AnyObject *response )
+        {
+          writer->Complete( buffer, *status );
+          delete status;
+          delete response;
+          delete this;
+        }
+
+        ZipAsyncWriter *writer;
+        char           *buffer;
+      };
+
+      // get a free buffer, waiting for a write to complete if all of them are in flight
+      char* Acquire()
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        done.wait( lock, [this]{ return failed || !freeBuffers.empty() || buffers.size() < maxInFlight; } );
+        if ( failed ) throw ZipHandlerException<AnyObject>( new XRootDStatus( error ), 0 );
+        if ( freeBuffers.empty() )
+        {
+          buffers.emplace_back( new char[bufferSize] );
+          return buffers.back().get();
+        }
+        char *buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        return buffer;
+      }
+
+      void Submit()
+      {
+        char *buffer = current;
+        current = 0;
+        {
+          std::unique_lock<std::mutex> lock( mutex );
+          ++inFlight;
+        }
+        WriteHandler *handler = new WriteHandler( this, buffer );
+        XRootDStatus st = archive.Write( currentOffset, currentSize, buffer, handler );
+        if ( !st.IsOK() )
+        {
+          delete handler;
+          Complete( buffer, st );
+        }
+      }
+
+      void Complete( char *buffer, const XRootDStatus &st )
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        if ( !st.IsOK() && !failed )
+        {
+          failed = true;
+          error = st;
+        }
+        freeBuffers.push_back( buffer );
+        --inFlight;
+        done.notify_all();
+      }
+
+      IO                                   &archive;
+      unsigned                              maxInFlight;
+      uint32_t                              bufferSize;
+      std::vector<std::unique_ptr<char[]>>  buffers;
+      std::vector<char*>                    freeBuffers;
+      unsigned                              inFlight;
+      bool                                  failed;
+      XRootDStatus                          error;
+      std::mutex                            mutex;
+      std::condition_variable               done;
+      char                                 *current;
+      uint64_t                              currentOffset;
+      uint32_t                              currentSize;
+  };
+
+  // a file to append with ZipArchive::AppendMany() or AppendFiles(), its data comes
+  // either from memory or from a file descriptor (read from offset 0)
+  struct ZipBatchEntry
+  {
+    ZipBatchEntry( std::string filename, const char *data, uint64_t size, time_t modTime, mode_t mode ) :
+      filename( filename ), data( data ), fd( -1 ), size( size ), modTime( modTime ), mode( mode )
+    {
+
+    }
+
+    ZipBatchEntry( std::string filename, int fd, uint64_t size, time_t modTime, mode_t mode ) :
+      filename( filename ), data( 0 ), fd( fd ), size( size ), modTime( modTime ), mode( mode )
+    {
+
+    }
+
+    std::string  filename;
+    const char  *data;
+    int          fd;
+    uint64_t     size;
+    time_t       modTime;
+    mode_t       mode;
+  };
+
+  // backend for a local archive file accessed with POSIX calls
+  // these are the members ZipArchiveEngine expects from a backend:
+  //  - Open( exists, size ): open the archive for reading and writing, create it with
+  //    permissions 644 if it does not exist, tell whether it existed and its size
+  //  - Read(), Write() and Close() behaving like the XrdCl::File calls
+  //  - Write() with a ResponseHandler, the handler may be called before it returns
+  //  - VectorRead( chunks ): read each chunk into its buffer, with at most
+  //    maxVectorChunks chunks of at most maxVectorChunkSize bytes
+  //  - Truncate( size ): cut the archive to size bytes
+  class ZipPosixIO
+  {
+    public:
+
+      ZipPosixIO( std::string archiveFilename ) : archiveFilename( archiveFilename ),
+                                                  archiveFd( -1 )
+      {
+
+      }
+
+      ~ZipPosixIO()
+      {
+        if ( archiveFd != -1 ) close( archiveFd );
+      }
+
+      ZipPosixIO( const ZipPosixIO& ) = delete;
+      ZipPosixIO& operator=( const ZipPosixIO& ) = delete;
+
+      XRootDStatus Open( bool &exists, uint64_t &size )
+      {
+        exists = true;
+        archiveFd = open( archiveFilename.c_str(), O_RDWR );
+        if ( archiveFd == -1 && errno == ENOENT )
+        {
+          exists = false;
+          archiveFd = open( archiveFilename.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+        }
+        if ( archiveFd == -1 )
+          return XRootDStatus( stError, errOSError, errno, "Failed to open archive." );
+
+        struct stat archiveInfo;
+        if ( fstat( archiveFd, &archiveInfo ) == -1 )
+          return XRootDStatus( stError, errOSError, errno, "Failed to stat archive." );
+        size = archiveInfo.st_size;
+        return XRootDStatus();
+      }
+
+      XRootDStatus Read( uint64_t offset, uint32_t size, void *buffer, uint32_t &bytesRead )
+      {
+        bytesRead = 0;
+        while ( bytesRead < size )
+        {
+          ssize_t n = pread( archiveFd, static_cast<char*>( buffer ) + bytesRead, size - bytesRead, offset + bytesRead );
+          if ( n == -1 && errno == EINTR ) continue;
+          if ( n == -1 ) return XRootDStatus( stError, errOSError, errno, "Failed to read archive." );
+          if ( n == 0 ) break;
+          bytesRead += n;
+        }
+        return XRootDStatus();
+      }
+
+      XRootDStatus Write( uint64_t offset, uint32_t size, const void *buffer )
+      {
+        uint32_t bytesWritten = 0;
+        while ( bytesWritten < size )
+        {
+          ssize_t n = pwrite( archiveFd, static_cast<const char*>( buffer ) + bytesWritten, size - bytesWritten, offset + bytesWritten );
+          if ( n == -1 && errno == EINTR ) continue;
+          if ( n <= 0 ) return XRootDStatus( stError, errOSError, errno, "Failed to write archive." );
+          bytesWritten += n;
+        }
+        return XRootDStatus();
+      }
+
+      // a local write is done synchronously and the handler called right away
+      XRootDStatus Write( uint64_t offset, uint32_t size, const void *buffer, ResponseHandler *handler )
+      {
+        XRootDStatus st = Write( offset, size, buffer );
+        handler->HandleResponse( new XRootDStatus( st ), 0 );
+        return XRootDStatus();
+      }
+
+      XRootDStatus VectorRead( const ChunkList &chunks )
+      {
+        for ( size_t i = 0; i < chunks.size(); ++i )
+        {
+          uint32_t bytesRead = 0;
+          XRootDStatus st = Read( chunks[i].offset, chunks[i].length, chunks[i].buffer, bytesRead );
+          if ( !st.IsOK() ) return st;
+          if ( bytesRead != chunks[i].length )
+            return XRootDStatus( stError, errDataError, errDataError, "Vector read past the end of the archive." );
+        }
+        return XRootDStatus();
+      }
+
+      XRootDStatus Truncate( uint64_t size )
+      {
+        if ( ftruncate( archiveFd, size ) == -1 )
+          return XRootDStatus( stError, errOSError, errno, "Failed to truncate archive." );
+        return XRootDStatus();
+      }
+
+      XRootDStatus Close()
+      {
+        int rc = close( archiveFd );
+        archiveFd = -1;
+        if ( rc == -1 ) return XRootDStatus( stError, errOSError, errno, "Failed to close archive." );
+        return XRootDStatus();
+      }
+
+      int Fd() const
+      {
+        return archiveFd;
+      }
+
+    protected:
+
+      std::string archiveFilename;
+      int         archiveFd;
+
+    public:
+
+      static const uint32_t maxVectorChunks = 1024;
+      static const uint32_t maxVectorChunkSize = 64 * 1024 * 1024;
+  };
+
+  // backend for an archive held in memory, to run the engine without any I/O
+  class ZipMemoryIO
+  {
+    public:
+
+      ZipMemoryIO( std::vector<char> &archive ) : archive( archive )
+      {
+
+      }
+
+      XRootDStatus Open( bool &exists, uint64_t &size )
+      {
+        exists = !archive.empty();
+        size = archive.size();
+        return XRootDStatus();
+      }
+
+      XRootDStatus Read( uint64_t offset, uint32_t size, void *buffer, uint32_t &bytesRead )
+      {
+        bytesRead = offset < archive.size() ? std::min<uint64_t>( size, archive.size() - offset ) : 0;
+        std::memcpy( buffer, archive.data() + offset, bytesRead );
+        return XRootDStatus();
+      }
+
+      // entries appended concurrently write at once, the vector may have to grow
+      XRootDStatus Write( uint64_t offset, uint32_t size, const void *buffer )
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        if ( offset + size > archive.size() ) archive.resize( offset + size );
+        std::memcpy( archive.data() + offset, buffer, size );
+        return XRootDStatus();
+      }
+
+      XRootDStatus Write( uint64_t offset, uint32_t size, const void *buffer, ResponseHandler *handler )
+      {
+        XRootDStatus st = Write( offset, size, buffer );
+        handler->HandleResponse( new XRootDStatus( st ), 0 );
+        return XRootDStatus();
+      }
+
+      XRootDStatus VectorRead( const ChunkList &chunks )
+      {
+        for ( size_t i = 0; i < chunks.size(); ++i )
+        {
+          if ( chunks[i].offset + chunks[i].length > archive.size() )
+            return XRootDStatus( stError, errDataError, errDataError, "Vector read past the end of the archive." );
+          std::memcpy( chunks[i].buffer, archive.data() + chunks[i].offset, chunks[i].length );
+        }
+        return XRootDStatus();
+      }
+
+      XRootDStatus Truncate( uint64_t size )
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        archive.resize( size );
+        return XRootDStatus();
+      }
+
+      XRootDStatus Close()
+      {
+        return XRootDStatus();
+      }
+
+      static const uint32_t maxVectorChunks = 1024;
+      static const uint32_t maxVectorChunkSize = 64 * 1024 * 1024;
+
+    private:
+
+      std::vector<char> &archive;
+      std::mutex         mutex;
+  };
+
+#ifdef ZIP_HAVE_LIBURING
+  // backend for a local archive file with the asynchronous writes submitted to an
+  // io_uring, a thread reaps the completions and calls the handlers
+  class ZipUringIO : public ZipPosixIO
+  {
+    public:
+
+      ZipUringIO( std::string archiveFilename, unsigned queueDepth = defaultQueueDepth ) : ZipPosixIO( archiveFilename )
+      {
+        hasRing = io_uring_queue_init( queueDepth, &ring, 0 ) == 0;
+      }
+
+      ~ZipUringIO()
+      {
+        if ( reaper.joinable() )
+        {
+          // a no-op without a request tells the reaper to stop
+          std::unique_lock<std::mutex> lock( mutex );
+          io_uring_sqe *sqe = GetSqe();
+          io_uring_prep_nop( sqe );
+          io_uring_sqe_set_data( sqe, 0 );
+          Submit();
+          lock.unlock();
+          reaper.join();
+        }
+        if ( hasRing ) io_uring_queue_exit( &ring );
+      }
+
+      using ZipPosixIO::Write;
+
+      XRootDStatus Write( uint64_t offset, uint32_t size, const void *buffer, ResponseHandler *handler )
+      {
+        if ( !hasRing ) return ZipPosixIO::Write( offset, size, buffer, handler );
+
+        std::unique_lock<std::mutex> lock( mutex );
+        io_uring_sqe *sqe = GetSqe();
+        Request *request = new Request( offset, size, buffer, handler );
+        io_uring_prep_write( sqe, archiveFd, buffer, size, offset );
+        io_uring_sqe_set_data( sqe, request );
+        if ( Submit() < 0 )
+        {
+          // the sqe stays in the ring and goes with the next submission: it is turned into
+          // a no-op the reaper skips, and the write is done here, so the handler is called
+          // once and the buffer is not used after this call
+          io_uring_prep_nop( sqe );
+          io_uring_sqe_set_data( sqe, Skipped() );
+          lock.unlock();
+          delete request;
+          return ZipPosixIO::Write( offset, size, buffer, handler );
+        }
+        if ( !reaper.joinable() ) reaper = std::thread( &ZipUringIO::Reap, this );
+        return XRootDStatus();
+      }
+
+    private:
+
+      struct Request
+      {
+        Request( uint64_t offset, uint32_t size, const void *buffer, ResponseHandler *handler ) :
+          offset( offset ), size( size ), buffer( static_cast<const char*>( buffer ) ), handler( handler )
+        {
+
+        }
+
+        uint64_t         offset;
+        uint32_t         size;
+        const char      *buffer;
+        ResponseHandler *handler;
+      };
+
+      // tag of the no-ops replacing writes which could not be submitted, not 0 as
+      // a no-op without a request stops the reaper
+      static Request* Skipped()
+      {
+        static Request skipped( 0, 0, 0, 0 );
+        return &skipped;
+      }
+
+      // submit the queued sqes, retrying while the kernel is only temporarily unable to
+      // take them (interrupted, out of resources or completion queue full)
+      int Submit()
+      {
+        int rc = 0;
+        for ( unsigned attempt = 0; attempt < maxSubmitAttempts; ++attempt )
+        {
+          rc = io_uring_submit( &ring );
+          if ( rc != -EINTR && rc != -EAGAIN && rc != -EBUSY ) break;
+          std::this_thread::yield();
+        }
+        return rc;
+      }
+
+      // the submission queue is only full if more writes are in flight than the
+      // queue depth, then the pending ones are pushed to the kernel to make room
+      io_uring_sqe* GetSqe()
+      {
+        io_uring_sqe *sqe = io_uring_get_sqe( &ring );
+        while ( !sqe )
+        {
+          io_uring_submit( &ring );
+          std::this_thread::yield();
+          sqe = io_uring_get_sqe( &ring );
+        }
+        return sqe;
+      }
+
+      void Reap()
+      {
+        while ( true )
+        {
+          io_uring_cqe *cqe = 0;
+          int rc = io_uring_wait_cqe( &ring, &cqe );
+          if ( rc == -EINTR ) continue;
+          if ( rc < 0 ) break;
+          Request *request = static_cast<Request*>( io_uring_cqe_get_data( cqe ) );
+          int res = cqe->res;
+          io_uring_cqe_seen( &ring, cqe );
+          if ( !request ) break;
+          if ( request == Skipped() ) continue;
+
+          XRootDStatus st;
+          if ( res < 0 )
+            st = XRootDStatus( stError, errOSError, -res, "Failed to write archive." );
+          else if ( uint32_t( res ) < request->size )
+            // finish a short write synchronously
+            st = ZipPosixIO::Write( request->offset + res, request->size - res, request->buffer + res );
+          request->handler->HandleResponse( new XRootDStatus( st ), 0 );
+          delete request;
+        }
+      }
+
+      struct io_uring ring;
+      bool            hasRing;
+      std::mutex      mutex;
+      std::thread     reaper;
+
+      static const unsigned defaultQueueDepth = 64;
+      static const unsigned maxSubmitAttempts = 1000;
+  };
+#endif
+
+  // copy size bytes of a local file, starting at fileOffset, into the archive at
+  // archiveOffset, through a buffer for the backends which can only write from memory
+  template<typename IO>
+  XRootDStatus ZipCopyFile( IO &io, int inputFd, uint64_t fileOffset, uint64_t archiveOffset, uint64_t size )
+  {
+    const uint32_t bufferSize = 8 * 1024 * 1024;
+    std::unique_ptr<char[]> buffer( new char[std::min<uint64_t>( bufferSize, size )] );
+    uint64_t copied = 0;
+    while ( copied < size )
+    {
+      ssize_t n = pread( inputFd, buffer.get(), std::min<uint64_t>( bufferSize, size - copied ), fileOffset + copied );
+      if ( n == -1 && errno == EINTR ) continue;
+      if ( n <= 0 ) return XRootDStatus( stError, errOSError, errno, "Failed to read input file." );
+      XRootDStatus st = io.Write( archiveOffset + copied, n, buffer.get() );
+      if ( !st.IsOK() ) return st;
+      copied += n;
+    }
+    return XRootDStatus();
+  }
+
+  // a local archive is filled kernel side, so the bytes never go through user space:
+  // copy_file_range() lets filesystems with reflinks share the extents instead of
+  // copying them, sendfile() is used if the files are on different filesystems or
+  // the kernel is too old, plain read/write if neither works
+  inline XRootDStatus ZipCopyFile( ZipPosixIO &io, int inputFd, uint64_t fileOffset, uint64_t archiveOffset, uint64_t size )
+  {
+    loff_t inOffset = fileOffset;
+    loff_t outOffset = archiveOffset;
+    uint64_t end = fileOffset + size;
+    while ( uint64_t( inOffset ) < end )
+    {
+      ssize_t n = copy_file_range( inputFd, &inOffset, io.Fd(), &outOffset, end - inOffset, 0 );
+      if ( n == -1 && errno == EINTR ) continue;
+      if ( n <= 0 ) break;
+    }
+
+    // sendfile() writes at the current position of the archive
+    off_t sendOffset = inOffset;
+    if ( uint64_t( sendOffset ) < end && lseek( io.Fd(), archiveOffset + ( sendOffset - fileOffset ), SEEK_SET ) != -1 )
+    {
+      while ( uint64_t( sendOffset ) < end )
+      {
+        ssize_t n = sendfile( io.Fd(), inputFd, &sendOffset, end - sendOffset );
+        if ( n == -1 && errno == EINTR ) continue;
+        if ( n <= 0 ) break;
+      }
+    }
+
+    uint64_t copied = sendOffset - fileOffset;
+    if ( copied == size ) return XRootDStatus();
+    return ZipCopyFile<ZipPosixIO>( io, inputFd, fileOffset + copied, archiveOffset + copied, size - copied );
+  }
+
+#ifdef ZIP_HAVE_LIBURING
+  inline XRootDStatus ZipCopyFile( ZipUringIO &io, int inputFd, uint64_t fileOffset, uint64_t archiveOffset, uint64_t size )
+  {
+    return ZipCopyFile( static_cast<ZipPosixIO&>( io ), inputFd, fileOffset, archiveOffset, size );
+  }
+#endif
+
+  // move size bytes of the archive from offset from to offset to in windows of windowSize
+  // bytes, so that the memory used does not depend on size: the ranges may overlap, the
+  // windows are then taken from the end when moving forward and from the start otherwise
+  // (like memmove() does), and a window is read while the one before is being written,
+  // which is safe as it is never a range that write touches
+  template<typename IO>
+  void ZipMoveRegion( IO &io, uint64_t from, uint64_t to, uint64_t size, uint32_t windowSize )
+  {
+    if ( from == to || size == 0 ) return;
+    bool backwards = to > from;
+    std::unique_ptr<char[]> buffer( new char[std::min<uint64_t>( windowSize, size )] );
+    ZipAsyncWriter<IO> writer( io, 2, windowSize );
+    for ( uint64_t done = 0; done < size; )
+    {
+      uint32_t length = std::min<uint64_t>( windowSize, size - done );
+      uint64_t offset = backwards ? size - done - length : done;
+      uint32_t bytesRead = 0;
+      XRootDStatus st = io.Read( from + offset, length, buffer.get(), bytesRead );
+      if ( st.IsOK() && bytesRead != length )
+        st = XRootDStatus( stError, errDataError, errDataError, "Failed to read the region of the archive to move." );
+      if ( !st.IsOK() ) throw ZipHandlerException<AnyObject>( new XRootDStatus( st ), 0 );
+      writer.Write( to + offset, buffer.get(), length );
+      done += length;
+    }
+    writer.Flush();
+  }
+
+  // a local archive is moved kernel side with copy_file_range(), which refuses to copy
+  // between overlapping ranges of a file, so the windows are no larger than the distance
+  // of the move; short distances, and whatever the kernel does not copy, go through memory
+  inline void ZipMoveRegion( ZipPosixIO &io, uint64_t from, uint64_t to, uint64_t size, uint32_t windowSize )
+  {
+    const uint64_t minKernelMove = 1024 * 1024;
+    uint64_t distance = to > from ? to - from : from - to;
+    if ( distance < minKernelMove ) return ZipMoveRegion<ZipPosixIO>( io, from, to, size, windowSize );
+    uint64_t window = std::min<uint64_t>( windowSize, distance );
+    bool backwards = to > from;
+    for ( uint64_t done = 0; done < size; )
+    {
+      uint64_t length = std::min( window, size - done );
+      uint64_t offset = backwards ? size - done - length : done;
+      loff_t inOffset = from + offset;
+      loff_t outOffset = to + offset;
+      uint64_t end = from + offset + length;
+      while ( uint64_t( inOffset ) < end )
+      {
+        ssize_t n = copy_file_range( io.Fd(), &inOffset, io.Fd(), &outOffset, end - inOffset, 0 );
+        if ( n == -1 && errno == EINTR ) continue;
+        if ( n <= 0 ) break;
+      }
+      if ( uint64_t( inOffset ) < end )
+        ZipMoveRegion<ZipPosixIO>( io, inOffset, outOffset, end - inOffset, windowSize );
+      done += length;
+    }
+  }
+
+#ifdef ZIP_HAVE_LIBURING
+  inline void ZipMoveRegion( ZipUringIO &io, uint64_t from, uint64_t to, uint64_t size, uint32_t windowSize )
+  {
+    ZipMoveRegion( static_cast<ZipPosixIO&>( io ), from, to, size, windowSize );
+  }
+#endif
+
+  // a range of the uncompressed data of an entry, for ZipArchiveEngine::ReadEntries()
+  struct ZipEntryRange
+  {
+    ZipEntryRange( std::string filename, uint64_t offset, uint32_t size, char *buffer ) :
+      filename( filename ), offset( offset ), size( size ), buffer( buffer ), bytesRead( 0 )
+    {
+
+    }
+
+    std::string  filename;
+    uint64_t     offset;
+    uint32_t     size;
+    char        *buffer;
+    uint32_t     bytesRead;
+  };
+
+  // an entry opened for reading: where its data starts in the archive and, if it is
+  // deflated, the inflate state so that a read continuing the previous one does not
+  // start from the beginning of the entry again
+  class ZipEntryReader
+  {
+    public:
+
+      ZipEntryReader( const ZipEntryInfo &info, uint64_t dataOffset ) : info( info ),
+                                                                        dataOffset( dataOffset ),
+                                                                        inflating( false ),
+                                                                        compressedOffset( 0 ),
+                                                                        position( 0 )
+      {
+        if ( info.compressionMethod != 0 && info.compressionMethod != ZipDeflater::deflateMethod )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errNotSupported, errNotSupported, "Unsupported compression method." ), 0 );
+        std::memset( &stream, 0, sizeof( stream ) );
+      }
+
+      ~ZipEntryReader()
+      {
+        if ( inflating ) inflateEnd( &stream );
+      }
+
+      ZipEntryReader( const ZipEntryReader& ) = delete;
+      ZipEntryReader& operator=( const ZipEntryReader& ) = delete;
+
+      // read up to size bytes of the uncompressed data from offset, returns the number
+      // of bytes read, less than size only at the end of the entry
+      template<typename IO>
+      uint32_t Read( IO &io, uint64_t offset, uint32_t size, char *buffer )
+      {
+        if ( offset >= info.uncompressedSize ) return 0;
+        if ( size > info.uncompressedSize - offset ) size = info.uncompressedSize - offset;
+
+        if ( info.compressionMethod == 0 )
+        {
+          uint32_t bytesRead = 0;
+          XRootDStatus st = io.Read( dataOffset + offset, size, buffer, bytesRead );
+          if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+          return bytesRead;
+        }
+
+        // inflate from the start unless the read is at or after the previous one
+        if ( !inflating || offset < position ) Restart();
+        char discard[skipSize];
+        while ( position < offset )
+        {
+          uint32_t skip = Inflate( io, discard, std::min<uint64_t>( skipSize, offset - position ) );
+          if ( skip == 0 ) return 0;
+        }
+        uint32_t bytesRead = 0;
+        while ( bytesRead < size )
+        {
+          uint32_t n = Inflate( io, buffer + bytesRead, size - bytesRead );
+          if ( n == 0 ) break;
+          bytesRead += n;
+        }
+        return bytesRead;
+      }
+
+      const ZipEntryInfo& Info() const
+      {
+        return info;
+      }
+
+      uint64_t DataOffset() const
+      {
+        return dataOffset;
+      }
+
+    private:
+
+      void Restart()
+      {
+        int rc = inflating ? inflateReset( &stream ) : inflateInit2( &stream, -15 );
+        if ( rc != Z_OK )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInternal, errInternal, "Failed to initialize inflate." ), 0 );
+        inflating = true;
+        stream.avail_in = 0;
+        compressedOffset = 0;
+        position = 0;
+      }
+
+      // inflate up to size bytes, reading the compressed data from the archive as needed
+      template<typename IO>
+      uint32_t Inflate( IO &io, char *buffer, uint32_t size )
+      {
+        stream.next_out = reinterpret_cast<Bytef*>( buffer );
+        stream.avail_out = size;
+        while ( stream.avail_out > 0 )
+        {
+          if ( stream.avail_in == 0 )
+          {
+            if ( compressedOffset >= info.compressedSize ) break;
+            if ( !input ) input.reset( new char[inputSize] );
+            uint32_t chunk = std::min<uint64_t>( inputSize, info.compressedSize - compressedOffset );
+            uint32_t bytesRead = 0;
+            XRootDStatus st = io.Read( dataOffset + compressedOffset, chunk, input.get(), bytesRead );
+            if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+            if ( bytesRead == 0 ) break;
+            compressedOffset += bytesRead;
+            stream.next_in = reinterpret_cast<Bytef*>( input.get() );
+            stream.avail_in = bytesRead;
+          }
+          int rc = inflate( &stream, Z_NO_FLUSH );
+          if ( rc == Z_STREAM_END ) break;
+          if ( rc != Z_OK && rc != Z_BUF_ERROR )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Corrupted deflate data." ), 0 );
+        }
+        uint32_t produced = size - stream.avail_out;
+        position += produced;
+        return produced;
+      }
+
+      ZipEntryInfo            info;
+      uint64_t                dataOffset;
+      z_stream                stream;
+      bool                    inflating;
+      uint64_t                compressedOffset;
+      uint64_t                position;
+      std::unique_ptr<char[]> input;
+
+      static const uint32_t skipSize = 64 * 1024;
+      static const uint32_t inputSize = 1024 * 1024;
+  };
+
+  // process-wide cache of the tail of archives (central directory, ZIP64 EOCD records
+  // and EOCD, as written by ZipArchiveEngine::Finalize()) keyed by archive URL, so that
+  // a process opening the same archive again and again does not read it every time;
+  // an entry is taken out of the cache while the archive is open (it is put back by
+  // Finalize(), or by Close() if nothing was appended), the oldest entries are evicted
+  // when the cache holds more than its capacity
+  class ZipTailCache
+  {
+    public:
+
+      struct Entry
+      {
+        Entry( uint64_t archiveSize, uint64_t tailSize, std::unique_ptr<char[]> tail ) : archiveSize( archiveSize ),
+                                                                                          tailSize( tailSize ),
+                                                                                          tail( std::move( tail ) )
+        {
+
+        }
+
+        uint64_t                archiveSize;
+        uint64_t                tailSize;
+        std::unique_ptr<char[]> tail;
+      };
+
+      static ZipTailCache& Instance()
+      {
+        static ZipTailCache cache;
+        return cache;
+      }
+
+      void Put( const std::string &key, std::shared_ptr<const Entry> entry )
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        Erase( key );
+        if ( entry->tailSize > capacity ) return;
+        order.push_back( key );
+        entries[key] = std::make_pair( entry, --order.end() );
+        size += entry->tailSize;
+        while ( size > capacity ) Erase( order.front() );
+      }
+
+      // remove the entry of key from the cache and return it, null if there is none
+      std::shared_ptr<const Entry> Take( const std::string &key )
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        auto itr = entries.find( key );
+        if ( itr == entries.end() ) return std::shared_ptr<const Entry>();
+        std::shared_ptr<const Entry> entry = itr->second.first;
+        Erase( key );
+        return entry;
+      }
+
+      // maximum number of bytes of archive tails kept
+      void SetCapacity( uint64_t capacity )
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        this->capacity = capacity;
+        while ( size > capacity ) Erase( order.front() );
+      }
+
+    private:
+
+      ZipTailCache() : size( 0 ), capacity( defaultCapacity )
+      {
+
+      }
+
+      void Erase( const std::string &key )
+      {
+        auto itr = entries.find( key );
+        if ( itr == entries.end() ) return;
+        size -= itr->second.first->tailSize;
+        order.erase( itr->second.second );
+        entries.erase( itr );
+      }
+
+      typedef std::pair<std::shared_ptr<const Entry>, std::list<std::string>::iterator> Slot;
+
+      std::mutex                             mutex;
+      std::unordered_map<std::string, Slot>  entries;
+      std::list<std::string>                 order;
+      uint64_t                               size;
+      uint64_t                               capacity;
+
+      static const uint64_t defaultCapacity = 256 * 1024 * 1024;
+  };
+
+  // a file appended with ZipArchiveEngine::AppendConcurrent(), shared by its handle and
+  // by the engine, which keeps it in a lock-free list until EndConcurrent() turns it into
+  // a central directory record; the handle cannot be used any more after that
+  struct ZipConcurrentEntry
+  {
+    ZipConcurrentEntry( LFH *lfh, mode_t mode, uint64_t offset, bool complete ) :
+      lfh( lfh ), mode( mode ), offset( offset ), complete( complete ), ended( false )
+    {
+
+    }
+
+    std::unique_ptr<LFH>  lfh;
+    mode_t                mode;
+    uint64_t              offset;
+    std::atomic<bool>     complete;
+    std::atomic<bool>     ended;
+  };
+
+  // handle to a file appended with ZipArchiveEngine::AppendConcurrent(): its LFH and data
+  // have a region of the archive of their own, so that every thread writes its files
+  // independently of the others, the handle is meant to be used by one thread and is
+  // move-only since the CRC-32 and the progress of the data are kept in it
+  template<typename IO>
+  class ZipEntryWriter
+  {
+    public:
+
+      ZipEntryWriter( IO &archive, std::shared_ptr<ZipConcurrentEntry> entry, uint64_t fileSize, bool computeCrc ) :
+        archive( archive ), entry( entry ), fileSize( fileSize ), computeCrc( computeCrc ), crc( 0 ), nextFileOffset( 0 )
+      {
+
+      }
+
+      ZipEntryWriter( ZipEntryWriter&& ) = default;
+      ZipEntryWriter( const ZipEntryWriter& ) = delete;
+      ZipEntryWriter& operator=( const ZipEntryWriter& ) = delete;
+
+      // write the contents of the buffer, fileOffset is its offset in the input file,
+      // if the CRC-32 is computed by the handle the data must be written sequentially
+      void Write( const char *buffer, uint32_t size, uint64_t fileOffset )
+      {
+        CheckOpen();
+        if ( fileOffset + size > fileSize )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInvalidArgs, errInvalidArgs, "File data exceeds the size given to AppendConcurrent()." ), 0 );
+        if ( computeCrc )
+        {
+          if ( fileOffset != nextFileOffset )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInvalidArgs, errInvalidArgs, "File data must be written sequentially when its CRC-32 is computed by ZipArchive." ), 0 );
+          crc = ZipCrc32::Update( crc, buffer, size );
+          nextFileOffset += size;
+        }
+        XRootDStatus st = archive.Write( DataOffset() + fileOffset, size, buffer );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( new XRootDStatus( st ), 0 );
+      }
+
+      // the file is complete: if its CRC-32 was computed, the LFH can now be written
+      void Close()
+      {
+        CheckOpen();
+        if ( entry->complete ) return;
+        if ( nextFileOffset != fileSize )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "File data is shorter than the size given to AppendConcurrent()." ), 0 );
+        entry->lfh->ZCRC32 = crc;
+        entry->lfh->Write( archive, entry->offset );
+        entry->complete = true;
+      }
+
+      uint64_t DataOffset() const
+      {
+        return entry->offset + entry->lfh->lfhSize;
+      }
+
+    private:
+
+      // the file was recorded by EndConcurrent(), its region may be overwritten
+      void CheckOpen() const
+      {
+        if ( entry->ended )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInvalidOp, errInvalidOp, "File appended with AppendConcurrent() used after EndConcurrent()." ), 0 );
+      }
+
+      IO                                  &archive;
+      std::shared_ptr<ZipConcurrentEntry>  entry;
+      uint64_t                             fileSize;
+      bool                                 computeCrc;
+      uint32_t                             crc;
+      uint64_t                             nextFileOffset;
+  };
+
+  // the archive engine, IO is the backend the archive is read from and written to
+  // (see ZipPosixIO for the members it must provide), the backend is a template
+  // parameter rather than an interface so the calls to it are not virtual
+  template<typename IO>
+  class ZipArchiveEngine
+  {
+    public:
+
+      // the arguments are passed on to the constructor of the backend
+      template<typename... Args>
+      explicit ZipArchiveEngine( Args&&... args ) : io( std::forward<Args>( args )... ),
+                                                    archiveSize( 0 ),
+                                                    existingCdSize( 0 ), 
+                                                    writeOffset( 0 ), 
+                                                    isOpen( false ), 
+                                                    nbCdRec( 0 ),
+                                                    newCdSize( 0 ),
+                                                    cdOffset( 0 ),
+                                                    computeCrc( false ),
+                                                    crc( 0 ),
+                                                    nextFileOffset( 0 ),
+                                                    nbThreads( 0 ),
+                                                    maxInFlight( defaultMaxInFlight ),
+                                                    asyncBufferSize( defaultAsyncBufferSize ),
+                                                    tailWindow( defaultTailWindow ),
+                                                    verifyCachedTail( true ),
+                                                    concurrent( false ),
+                                                    dataEnd( 0 ),
+                                                    concurrentEntries( 0 ),
+                                                    tailOffset( noTail ),
+                                                    tailRecords( 0 ),
+                                                    relocationWindow( 0 ),
+                                                    parkedCdOffset( 0 ),
+                                                    dataStart( 0 ),
+                                                    fileEnd( 0 )
+      { 
+
+      }
+
+      // files appended concurrently but never recorded
+      ~ZipArchiveEngine()
+      {
+        ConcurrentNode *node = concurrentEntries.load();
+        while ( node )
+        {
+          ConcurrentNode *next = node->next;
+          delete node;
+          node = next;
+        }
+      }
+      
+      // open archive file for reading and writing and with file permissions 644
+      void Open()
+      {
+        // the backend opens the archive, creating it if it does not exist yet
+        openEntries.clear();
+        index.reset();
+        indexFile.reset();
+        tailOffset = noTail;
+        bool exists = false;
+        XRootDStatus st = io.Open( exists, archiveSize );
+        if ( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+        isOpen = true;
+        fileEnd = archiveSize;
+
+        if ( exists && relocationWindow == 0 && OpenFromCache() ) return;
+
+        if ( exists )
+        {
+          // read the tail of the archive speculatively: the EOCD with the longest possible
+          // comment, the ZIP64 EOCD locator and record, and usually the central directory,
+          // so that an archive is opened with one read, only what is missing is read after
+          uint32_t size = std::min( uint64_t( tailWindow ), archiveSize );
+          uint64_t offset = archiveSize - size;
+          buffer.reset( new char[size] );
+          uint32_t bytesRead = 0;
+          st = io.Read( offset, size, buffer.get(), bytesRead );
+          if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+          if ( bytesRead != size )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Failed to read the end of the archive." ), 0 );
+
+          // find and store existing EOCD, ZIP64EOCD, ZIP64EOCDL and central directory records
+          st = ReadCentralDirectory( size );
+          if ( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+          buffer.reset();
+        }
+      }
+
+      // keep the tail of the archive in the process-wide ZipTailCache under key (its URL):
+      // Open() then takes the central directory from the cache if the size of the archive
+      // has not changed since the last Finalize() in this process and, if verify is set,
+      // if the end of the archive (its last tailCheckSize bytes, read instead of the tail
+      // window) is still what was written
+      void SetTailCache( const std::string &key, bool verify = true )
+      {
+        cacheKey = key;
+        verifyCachedTail = verify;
+      }
+
+      // number of bytes read from the end of an existing archive by Open(), at least enough
+      // for the EOCD records; a central directory which fits in it takes no extra read
+      void SetTailWindow( uint32_t size )
+      {
+        tailWindow = std::max( size, uint32_t( minTailWindow ) );
+      }
+
+      // keep the central directory of an existing archive in the archive rather than in
+      // memory, so that memory use does not depend on its size: Open() does not read it,
+      // it is moved out of the way before new data would overwrite it and moved after the
+      // data by Finalize() or Checkpoint(), windowSize bytes at a time; the entries of the
+      // archive cannot be looked up, listed or extracted, and neither the sidecar index
+      // nor the tail cache are used; call before Open(), a windowSize of 0 turns it off
+      void SetCdRelocation( uint32_t windowSize = defaultRelocationWindow )
+      {
+        relocationWindow = windowSize;
+      }
+      
+      // prepare archive for appending file
+      // create headers, update end of central directory record and write LFH to the archive
+      void Append( std::string filename, uint32_t crc, off_t fileSize, time_t fileModTime, mode_t fileMode )
+      {
+        // the previous file is complete, make sure its headers are final
+        EndFile();
+
+        lfh.reset( new LFH( filename, crc, fileSize, fileModTime ) );
+        ReserveData( cdOffset + lfh->lfhSize + fileSize );
+        WriteLfh( fileMode );
+        // the file data size is known, so is the offset of the next LFH
+        cdOffset += fileSize;
+      }
+
+      // prepare archive for appending file without a precomputed CRC-32
+      // the CRC-32 is computed as the file data passes through WriteFileData()
+      // and patched into the LFH and CDFH once the file is complete
+      void Append( std::string filename, off_t fileSize, time_t fileModTime, mode_t fileMode )
+      {
+        Append( filename, 0, fileSize, fileModTime, fileMode );
+        computeCrc = true;
+        crc = 0;
+        nextFileOffset = 0;
+      }
+
+      // prepare archive for appending file compressed with deflate
+      // the data passed to WriteFileData() is compressed in blocks on a pool of threads,
+      // the crc and compressed size are patched into the LFH and CDFH once the file is complete
+      void AppendDeflated( std::string filename, off_t fileSize, time_t fileModTime, mode_t fileMode,
+                           int level = Z_DEFAULT_COMPRESSION )
+      {
+        EndFile();
+
+        // the LFH needs a ZIP64 extra field if the compressed data might reach 4 GB
+        bool zip64 = ZipDeflater::Bound( fileSize ) >= ovrflw32;
+        lfh.reset( new LFH( filename, 0, zip64 ? ovrflw32 : 0, fileModTime ) );
+        lfh->SetCompressionMethod( ZipDeflater::deflateMethod );
+        lfh->SetSizes( 0, 0, fileSize );
+        ReserveData( cdOffset + lfh->lfhSize + ZipDeflater::Bound( fileSize ) );
+        WriteLfh( fileMode );
+
+        if ( !pool ) pool.reset( new ZipThreadPool( nbThreads ) );
+        uint64_t dataOffset = writeOffset;
+        IO &io = this->io;
+        deflater.reset( new ZipDeflater( *pool, [&io, dataOffset]( const char *buffer, uint32_t size, uint64_t offset )
+        {
+          XRootDStatus st = io.Write( dataOffset + offset, size, buffer );
+          if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+        }, level ) );
+        nextFileOffset = 0;
+      }
+
+      // switch to concurrent appending: until EndConcurrent(), which the next sequential
+      // append, lookup or Finalize() calls, the only calls allowed are AppendConcurrent(),
+      // from any number of threads at the same time, and the calls to the handles it returns
+      void BeginConcurrent()
+      {
+        EndFile();
+        Flush();
+        // how far the data will go is not known, the central directory cannot be moved
+        if ( relocationWindow > 0 && existingCdSize > 0 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errNotSupported, errNotSupported, "Concurrent appends are not supported when the central directory is relocated." ), 0 );
+        dataEnd.store( cdOffset );
+        concurrent = true;
+      }
+
+      // append a file of known size from any thread: the region of its LFH and data is
+      // reserved with an atomic add on the end of the data, so that there is no lock and
+      // no shared offset, the data is written through the handle returned
+      ZipEntryWriter<IO> AppendConcurrent( std::string filename, uint32_t crc, uint64_t fileSize, time_t fileModTime, mode_t fileMode )
+      {
+        return AppendConcurrent( filename, crc, fileSize, fileModTime, fileMode, false );
+      }
+
+      // same as above with the CRC-32 computed by the handle as the data passes through it,
+      // the LFH is then written by ZipEntryWriter::Close()
+      ZipEntryWriter<IO> AppendConcurrent( std::string filename, uint64_t fileSize, time_t fileModTime, mode_t fileMode )
+      {
+        return AppendConcurrent( filename, 0, fileSize, fileModTime, fileMode, true );
+      }
+
+      // back to sequential appending, all the handles must have been closed: the files
+      // appended concurrently are recorded in the central directory in the order of
+      // their offsets and the next file goes after the last of them; if a handle is not
+      // closed nothing changes, it can still be closed and EndConcurrent() called again
+      void EndConcurrent()
+      {
+        if ( !concurrent ) return;
+        for ( ConcurrentNode *node = concurrentEntries.load(); node; node = node->next )
+          if ( !node->entry->complete )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInvalidOp, errInvalidOp, "File appended with AppendConcurrent() not closed." ), 0 );
+        concurrent = false;
+
+        std::vector<std::unique_ptr<ConcurrentNode>> nodes;
+        for ( ConcurrentNode *node = concurrentEntries.exchange( 0 ); node; node = node->next )
+          nodes.emplace_back( node );
+        std::sort( nodes.begin(), nodes.end(), []( const std::unique_ptr<ConcurrentNode> &a, const std::unique_ptr<ConcurrentNode> &b )
+        {
+          return a->entry->offset < b->entry->offset;
+        } );
+
+        cdOffset = dataEnd.load();
+        writeOffset = cdOffset;
+        for ( size_t i = 0; i < nodes.size(); ++i )
+        {
+          ZipConcurrentEntry &entry = *nodes[i]->entry;
+          entry.ended = true;
+          AddCdRecord( *entry.lfh, entry.mode, entry.offset );
+        }
+      }
+
+      // number of threads used to compress files, 0 means one per hardware thread
+      void SetNbThreads( unsigned nbThreads )
+      {
+        this->nbThreads = nbThreads;
+        pool.reset();
+      }
+
+      // append a local file, its data is copied into the archive by the backend,
+      // kernel side if it can (see ZipCopyFile()), the CRC-32 is computed beforehand
+      // on the pool of threads
+      void AppendFile( std::string filename, int inputFd )
+      {
+        struct stat fileInfo;
+        if ( fstat( inputFd, &fileInfo ) == -1 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to stat input file." ), 0 );
+        if ( !pool ) pool.reset( new ZipThreadPool( nbThreads ) );
+        AppendFile( filename, inputFd, ZipCrc32::ComputeParallel( inputFd, 0, fileInfo.st_size, *pool ) );
+      }
+
+      // same as above with a precomputed CRC-32, the file data is not read at all
+      // in user space if the backend can copy it kernel side
+      void AppendFile( std::string filename, int inputFd, uint32_t crc )
+      {
+        struct stat fileInfo;
+        if ( fstat( inputFd, &fileInfo ) == -1 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to stat input file." ), 0 );
+        Append( filename, crc, fileInfo.st_size, fileInfo.st_mtime, fileInfo.st_mode );
+        XRootDStatus st = ZipCopyFile( io, inputFd, 0, writeOffset, fileInfo.st_size );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+      }
+
+      // append many (small) files at once: the LFHs and data are laid out contiguously
+      // in a buffer of up to maxBatchSize bytes which is written to the archive in one
+      // go, so the cost is one round trip per batch instead of several per file
+      // files which do not fit in a batch on their own are appended one by one
+      void AppendMany( const std::vector<ZipBatchEntry> &entries, uint32_t maxBatchSize = defaultBatchSize )
+      {
+        EndFile();
+
+        std::vector<char> batch;
+        batch.reserve( maxBatchSize );
+        uint64_t batchOffset = cdOffset;
+
+        for ( size_t i = 0; i < entries.size(); ++i )
+        {
+          const ZipBatchEntry &entry = entries[i];
+          LFH lfh( entry.filename, 0, entry.size, entry.modTime );
+
+          if ( lfh.lfhSize + entry.size > maxBatchSize - batch.size() )
+          {
+            FlushBatch( batch, batchOffset );
+            if ( lfh.lfhSize + entry.size > maxBatchSize )
+            {
+              AppendLarge( entry );
+              batchOffset = cdOffset;
+              continue;
+            }
+          }
+
+          // file data goes right after the LFH, which is filled in once the crc is known
+          size_t lfhPos = batch.size();
+          batch.resize( lfhPos + lfh.lfhSize + entry.size );
+          char *data = batch.data() + lfhPos + lfh.lfhSize;
+          if ( entry.data )
+            std::memcpy( data, entry.data, entry.size );
+          else
+            ReadInput( entry.fd, data, entry.size, 0 );
+          lfh.ZCRC32 = ZipCrc32::Update( 0, data, entry.size );
+          lfh.Serialize( batch.data() + lfhPos );
+
+          AddCdRecord( lfh, entry.mode, cdOffset );
+          cdOffset += lfh.lfhSize + entry.size;
+        }
+
+        FlushBatch( batch, batchOffset );
+      }
+
+      // append files whose sizes are all known up front: the layout is planned first (the
+      // offset of every LFH follows from the sizes of the files before it), then the data
+      // is copied into its place on the pool of threads, small files packed together into
+      // one write along with their LFHs, large files in chunks of chunkSize bytes whose LFH
+      // is written once the CRC-32 of all the chunks is known; Finalize() then writes the
+      // central directory in one go as usual
+      void AppendFiles( const std::vector<ZipBatchEntry> &entries, uint32_t chunkSize = defaultBatchSize )
+      {
+        EndFile();
+        Flush();
+        if ( !pool ) pool.reset( new ZipThreadPool( nbThreads ) );
+
+        // planning pass: the LFHs, their offsets and the pieces of work
+        std::vector<std::unique_ptr<LFH>> headers( entries.size() );
+        std::vector<uint64_t> offsets( entries.size() );
+        std::vector<CopyUnit> units;
+        uint64_t offset = cdOffset;
+        uint64_t packedSize = 0;
+        for ( size_t i = 0; i < entries.size(); ++i )
+        {
+          const ZipBatchEntry &entry = entries[i];
+          headers[i].reset( new LFH( entry.filename, 0, entry.size, entry.modTime ) );
+          offsets[i] = offset;
+          uint64_t size = headers[i]->lfhSize + entry.size;
+          offset += size;
+
+          if ( entry.size > chunkSize )
+          {
+            for ( uint64_t done = 0; done < entry.size; done += chunkSize )
+              units.push_back( CopyUnit( i, done, std::min<uint64_t>( chunkSize, entry.size - done ) ) );
+            packedSize = 0;
+            continue;
+          }
+          if ( packedSize == 0 || packedSize + size > chunkSize )
+          {
+            units.push_back( CopyUnit( i ) );
+            packedSize = 0;
+          }
+          units.back().end = i + 1;
+          packedSize += size;
+        }
+
+        ReserveData( offset );
+        std::vector<std::future<uint32_t>> tasks;
+        tasks.reserve( units.size() );
+        for ( size_t u = 0; u < units.size(); ++u )
+        {
+          const CopyUnit &unit = units[u];
+          tasks.push_back( pool->Submit( [this, &entries, &headers, &offsets, unit]()
+          {
+            return unit.packed ? CopyPacked( entries, headers, offsets, unit ) : CopyChunk( entries[unit.begin], *headers[unit.begin], offsets[unit.begin], unit );
+          } ) );
+        }
+
+        // wait for every task before returning, they refer to the plan; the CRC-32 of a
+        // large file is combined from those of its chunks, then its LFH can be written
+        std::exception_ptr error;
+        std::vector<std::future<uint32_t>> lfhWrites;
+        uint32_t crc = 0;
+        for ( size_t u = 0; u < units.size(); ++u )
+        {
+          const CopyUnit &unit = units[u];
+          try
+          {
+            uint32_t part = tasks[u].get();
+            if ( unit.packed ) continue;
+            crc = ZipCrc32::Combine( unit.fileOffset == 0 ? 0 : crc, part, unit.size );
+            if ( unit.fileOffset + unit.size < entries[unit.begin].size || error ) continue;
+            LFH &header = *headers[unit.begin];
+            header.ZCRC32 = crc;
+            uint64_t lfhOffset = offsets[unit.begin];
+            lfhWrites.push_back( pool->Submit( [this, &header, lfhOffset]()
+            {
+              header.Write( io, lfhOffset );
+              return uint32_t( 0 );
+            } ) );
+          }
+          catch ( ... ) { if ( !error ) error = std::current_exception(); }
+        }
+        for ( size_t i = 0; i < lfhWrites.size(); ++i )
+        {
+          try { lfhWrites[i].get(); }
+          catch ( ... ) { if ( !error ) error = std::current_exception(); }
+        }
+        if ( error ) std::rethrow_exception( error );
+
+        for ( size_t i = 0; i < entries.size(); ++i )
+          AddCdRecord( *headers[i], entries[i].mode, offsets[i] );
+        cdOffset = offset;
+        writeOffset = cdOffset;
+      }
+
+      // the buffer holds the last size bytes of the archive, the EOCD is searched backwards
+      // and every candidate validated, so that the signature appearing in the comment or in
+      // file data is skipped: its comment must end the archive (if no candidate does, the
+      // one whose comment ends last is taken, for archives with trailing bytes) and the
+      // central directory it points to must make sense (see EOCD::IsValid())
+      char* LookForEocd( uint64_t size )
+      {
+        if( size < EOCD::eocdBaseSize ) return 0;
+        uint64_t buffOffset = archiveSize - size;
+        char *fallback = 0;
+        uint64_t fallbackEnd = 0;
+        for( size_t count = size - EOCD::eocdBaseSize + 1; count > 0; )
+        {
+          ssize_t offset = ZipSignatureScan::FindLast( buffer.get(), count, EOCD::eocdSign );
+          if( offset < 0 ) break;
+          count = offset;
+
+          char *eocdBlock = buffer.get() + offset;
+          uint16_t commentLength;
+          std::memcpy( &commentLength, eocdBlock + 20, 2 );
+          uint64_t end = offset + EOCD::eocdBaseSize + commentLength;
+          if( end > size || !EOCD::IsValid( eocdBlock, buffOffset + offset ) ) continue;
+          if( end == size ) return eocdBlock;
+          if( end > fallbackEnd )
+          {
+            fallback = eocdBlock;
+            fallbackEnd = end;
+          }
+        }
+        return fallback;
+      }
+
+      // taken from XrdClZipArchiveReader.cc (modified ReadCdfh())
+      XRootDStatus ReadCentralDirectory( uint64_t bytesRead )
+      {
+        char *eocdBlock = LookForEocd( bytesRead );
+        if( !eocdBlock ) throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "End-of-central-directory signature not found." ), 0 );
+        eocd.reset( new EOCD( eocdBlock ) );
+
+        // the offset at which we did the read
+        uint64_t buffOffset = archiveSize - bytesRead;
+
+        // Let's see if it is ZIP64 (if yes, the EOCD will be preceded with ZIP64 EOCD locator)
+        char *zip64EocdlBlock = eocdBlock - ZIP64_EOCDL::zip64EocdlSize;
+        // make sure there is enough data to assume there's a ZIP64 EOCD locator
+        if( zip64EocdlBlock >= buffer.get() )
+        {
+          uint32_t *signature = reinterpret_cast<uint32_t*>( zip64EocdlBlock );
+          if( *signature == ZIP64_EOCDL::zip64EocdlSign )
+          {
+            zip64Eocdl.reset( new ZIP64_EOCDL( zip64EocdlBlock ) );
+            char zip64EocdBuffer[ZIP64_EOCD::zip64EocdBaseSize];
+            char *zip64EocdBlock = zip64EocdBuffer;
+            if( zip64Eocdl->zip64EocdOffset >= buffOffset &&
+                zip64Eocdl->zip64EocdOffset + ZIP64_EOCD::zip64EocdBaseSize <= archiveSize )
+              zip64EocdBlock = buffer.get() + ( zip64Eocdl->zip64EocdOffset - buffOffset );
+            else
+            {
+              // not in the tail window, we need to read more data
+              uint32_t bytes = 0;
+              XRootDStatus st = io.Read( zip64Eocdl->zip64EocdOffset, ZIP64_EOCD::zip64EocdBaseSize, zip64EocdBuffer, bytes );
+              if( !st.IsOK() ) return st;
+              if( bytes != ZIP64_EOCD::zip64EocdBaseSize )
+                throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "ZIP64 End-of-central-directory signature not found." ), 0 );
+            }
+
+            signature = reinterpret_cast<uint32_t*>( zip64EocdBlock );
+            if( *signature != ZIP64_EOCD::zip64EocdSign )
+              throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "ZIP64 End-of-central-directory signature not found." ), 0 );
+            zip64Eocd.reset( new ZIP64_EOCD( zip64EocdBlock ) );
+            eocd->useZip64 = true;
+          }
+          /*
+          else
+            it is not ZIP64 so we have everything in EOCD
+          */
+        }
+
+        uint64_t offset = eocd->useZip64 ? zip64Eocd->cdOffset : eocd->cdOffset;
+        existingCdSize  = eocd->useZip64 ? zip64Eocd->cdSize   : eocd->cdSize;
+        nbCdRec         = eocd->useZip64 ? zip64Eocd->nbCdRec  : eocd->nbCdRec;
+        // new files are appended where the central directory starts now
+        cdOffset        = offset;
+        tailOffset      = offset;
+        tailRecords     = nbCdRec;
+        if( offset + existingCdSize > archiveSize )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Central directory beyond the end of the archive." ), 0 );
+        if( relocationWindow > 0 )
+        {
+          // the central directory stays where it is until new data needs its place
+          parkedCdOffset = offset;
+          dataStart = offset;
+          return XRootDStatus();
+        }
+        // the part of the central directory which is in the tail window is not read again
+        uint64_t inTail = 0;
+        const char *tailCd = 0;
+        if( offset + existingCdSize > buffOffset )
+        {
+          inTail = offset + existingCdSize - std::max( offset, buffOffset );
+          tailCd = buffer.get() + ( std::max( offset, buffOffset ) - buffOffset );
+        }
+
+        // a sidecar index matching the archive replaces the central directory altogether,
+        // whatever part of the central directory was read must be identical in the index
+        if( !indexPath.empty() )
+        {
+          std::unique_ptr<ZipIndexFile> mapped( new ZipIndexFile() );
+          if( mapped->Map( indexPath, archiveSize, offset, existingCdSize, nbCdRec ) &&
+              ( inTail == 0 || std::memcmp( mapped->Cd() + ( existingCdSize - inTail ), tailCd, inTail ) == 0 ) )
+          {
+            indexFile.swap( mapped );
+            cdBuffer.reset();
+            return XRootDStatus();
+          }
+        }
+
+        cdBuffer.reset( new char[existingCdSize] );
+        if( inTail > 0 )
+        {
+          std::memcpy( cdBuffer.get() + ( existingCdSize - inTail ), tailCd, inTail );
+        }
+        if( inTail == existingCdSize ) return XRootDStatus();
+
+        return ReadBuffer( offset, existingCdSize - inTail, cdBuffer.get() );
+      }
+
+      // look up an entry by name, in the central directory read from the archive and
+      // among the files appended since, returns false if there is no such entry
+      bool Find( const std::string &filename, ZipEntryInfo &info )
+      {
+        return Index().Find( filename, info );
+      }
+
+      bool Contains( const std::string &filename )
+      {
+        return Index().Contains( filename );
+      }
+
+      // the central directory of the archive as it was opened, its records are decoded
+      // in place while iterating, e.g. for ( const ZipEntryView &entry : CentralDirectory() )
+      ZipCdView CentralDirectory() const
+      {
+        CheckCdInMemory();
+        return ZipCdView( ExistingCd(), existingCdSize );
+      }
+
+      // call f( const ZipEntryView& ) for every entry of the archive: the central directory
+      // as it was opened, then the files appended since (whose names are in the store)
+      template<typename F>
+      void ForEachEntry( F f ) const
+      {
+        ZipCdView records = CentralDirectory();
+        for ( ZipCdIterator itr = records.begin(); itr != records.end(); ++itr )
+          f( *itr );
+        ZipEntryView entry;
+        for ( size_t i = 0; i < cdRecords.Size(); ++i )
+        {
+          cdRecords.GetEntry( i, entry.info );
+          entry.name = cdRecords.Filename( i );
+          entry.nameLength = cdRecords.FilenameLength( i );
+          f( entry );
+        }
+      }
+
+      // prepare an entry for ReadEntry(): look it up in the central directory, then read
+      // its LFH, whose filename and extra field lengths tell where the data starts
+      void OpenEntry( const std::string &filename )
+      {
+        OpenedEntry( filename );
+      }
+
+      // read up to size bytes of the uncompressed data of an entry from offset, only the
+      // bytes of the entry are read from the archive (with one ranged read if it is
+      // stored), returns the number of bytes read, less than size only at the end of the
+      // entry; the entry is opened if OpenEntry() has not been called
+      uint32_t ReadEntry( const std::string &filename, uint64_t offset, uint32_t size, char *buffer )
+      {
+        ZipEntryReader &reader = OpenedEntry( filename );
+        // the data of a file appended in this session may still be on its way
+        Flush();
+        return reader.Read( io, offset, size, buffer );
+      }
+
+      void CloseEntry( const std::string &filename )
+      {
+        openEntries.erase( filename );
+      }
+
+      // read ranges of many entries with vector reads: the byte ranges they need in the
+      // archive are sorted, ranges less than maxGap bytes apart are merged, and the result
+      // is split to the vector read limits of the backend, so a few hundred small entries
+      // take one request; the LFHs of entries which were not opened yet are read in the
+      // same request, with a margin around the data in case their extra field differs
+      // from the one in the central directory (a single read completes any miss)
+      void ReadEntries( std::vector<ZipEntryRange> &ranges, uint32_t maxGap = defaultMaxGap )
+      {
+        Flush();
+
+        std::vector<Span> spans;
+        std::vector<ZipEntryInfo> infos( ranges.size() );
+        for ( size_t i = 0; i < ranges.size(); ++i )
+        {
+          ZipEntryRange &range = ranges[i];
+          ZipEntryInfo &info = infos[i];
+          if ( !Find( range.filename, info ) )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errNotFound, errNotFound, "No such file in the archive." ), 0 );
+
+          // what is needed of the data: the range itself if the entry is stored,
+          // the whole compressed stream otherwise
+          uint64_t begin = 0, end = info.compressedSize;
+          if ( info.compressionMethod == 0 )
+          {
+            begin = std::min( range.offset, info.uncompressedSize );
+            end = std::min( begin + range.size, info.uncompressedSize );
+          }
+
+          auto itr = openEntries.find( range.filename );
+          if ( itr != openEntries.end() )
+          {
+            uint64_t dataOffset = itr->second->DataOffset();
+            spans.push_back( Span( dataOffset + begin, dataOffset + end ) );
+            continue;
+          }
+          // the data offset is a guess until the LFH is read
+          uint64_t dataOffset = EstimatedDataOffset( info );
+          spans.push_back( Span( info.offset, dataOffset + lfhMargin ) );
+          spans.push_back( Span( dataOffset + begin - std::min( uint64_t( lfhMargin ), dataOffset + begin ), dataOffset + end + lfhMargin ) );
+        }
+
+        uint64_t archiveEnd = std::max( archiveSize, cdOffset );
+        std::unique_ptr<char[]> data( ReadSpans( spans, maxGap, archiveEnd ) );
+        SpanReader reader( io, spans, data.get() );
+
+        for ( size_t i = 0; i < ranges.size(); ++i )
+        {
+          ZipEntryRange &range = ranges[i];
+          auto itr = openEntries.find( range.filename );
+          if ( itr == openEntries.end() )
+          {
+            uint64_t dataOffset = ReadDataOffset( reader, infos[i] );
+            itr = openEntries.emplace( range.filename, std::unique_ptr<ZipEntryReader>( new ZipEntryReader( infos[i], dataOffset ) ) ).first;
+          }
+          range.bytesRead = itr->second->Read( reader, range.offset, range.size, range.buffer );
+        }
+      }
+
+      // read whole entries with vector reads, see above
+      void ReadEntries( const std::vector<std::string> &filenames, std::vector<std::vector<char>> &contents,
+                        uint32_t maxGap = defaultMaxGap )
+      {
+        contents.resize( filenames.size() );
+        std::vector<ZipEntryRange> ranges;
+        for ( size_t i = 0; i < filenames.size(); ++i )
+        {
+          ZipEntryInfo info;
+          if ( !Find( filenames[i], info ) )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errNotFound, errNotFound, "No such file in the archive." ), 0 );
+          if ( info.uncompressedSize >= ovrflw32 )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInvalidArgs, errInvalidArgs, "File too large to be read at once." ), 0 );
+          contents[i].resize( info.uncompressedSize );
+          ranges.push_back( ZipEntryRange( filenames[i], 0, info.uncompressedSize, contents[i].data() ) );
+        }
+        ReadEntries( ranges, maxGap );
+      }
+
+      // extract every file of the archive into directory on the pool of threads: runs of
+      // small files which are next to each other in the archive are read with one read per
+      // run, large stored files in ranges of rangeSize bytes read concurrently, and large
+      // deflated files are inflated in one stream each; output files are preallocated and
+      // written with pwrite, and their CRC-32 is checked; the file being appended is
+      // ended first, as by Finalize(), so all its data must have been written
+      void ExtractAll( const std::string &directory, uint64_t rangeSize = defaultExtractRangeSize )
+      {
+        EndFile();
+        Flush();
+        if ( rangeSize == 0 ) rangeSize = defaultExtractRangeSize;
+        const std::string root = directory.empty() ? std::string( "." ) : directory;
+        if ( !pool ) pool.reset( new ZipThreadPool( nbThreads ) );
+
+        // if a name appears more than once the last entry wins, as for Find()
+        std::vector<ExtractedFile> files;
+        std::unordered_map<std::string, size_t> positions;
+        std::unordered_set<std::string> directories;
+        MakeDirectories( root + "/", directories );
+        ForEachEntry( [&]( const ZipEntryView &entry )
+        {
+          std::string path = OutputPath( root, entry.Name() );
+          MakeDirectories( path, directories );
+          if ( path.back() == '/' ) return;
+          auto result = positions.emplace( path, files.size() );
+          if ( result.second )
+            files.push_back( ExtractedFile( path, entry.info ) );
+          else
+            files[result.first->second] = ExtractedFile( path, entry.info );
+        } );
+        std::sort( files.begin(), files.end() );
+
+        // the LFHs of the large files are needed to split them, they are fetched with vector reads
+        uint64_t archiveEnd = std::max( archiveSize, cdOffset );
+        std::vector<Span> lfhSpans;
+        for ( size_t i = 0; i < files.size(); ++i )
+        {
+          if ( files[i].IsSmall( rangeSize ) ) continue;
+          lfhSpans.push_back( Span( files[i].info.offset, EstimatedDataOffset( files[i].info ) + lfhMargin ) );
+        }
+        std::unique_ptr<char[]> lfhData( ReadSpans( lfhSpans, defaultMaxGap, archiveEnd ) );
+        SpanReader lfhReader( io, lfhSpans, lfhData.get() );
+
+        std::vector<std::future<void>> tasks;
+        std::vector<std::pair<size_t, std::vector<std::future<uint32_t>>>> splits;
+        for ( size_t i = 0; i < files.size(); )
+        {
+          if ( files[i].IsSmall( rangeSize ) )
+          {
+            // extend the run while the files are contiguous and it fits in one range
+            uint64_t begin = files[i].info.offset;
+            uint64_t end = std::min( files[i].EstimatedEnd(), archiveEnd );
+            size_t first = i++;
+            while ( i < files.size() && files[i].IsSmall( rangeSize ) && files[i].info.offset <= end + defaultMaxGap &&
+                    std::min( files[i].EstimatedEnd(), archiveEnd ) - begin <= rangeSize )
+              end = std::max( end, std::min( files[i++].EstimatedEnd(), archiveEnd ) );
+            std::vector<ExtractedFile> run( files.begin() + first, files.begin() + i );
+            tasks.push_back( pool->Submit( [this, run, begin, end]() { ExtractRun( run, begin, end ); } ) );
+            continue;
+          }
+
+          const ExtractedFile &file = files[i++];
+          uint64_t dataOffset = ReadDataOffset( lfhReader, file.info );
+          if ( file.info.compressionMethod != 0 )
+          {
+            tasks.push_back( pool->Submit( [this, file, dataOffset, rangeSize]() { ExtractDeflated( file, dataOffset, rangeSize ); } ) );
+            continue;
+          }
+          close( CreateOutput( file ) );
+          splits.push_back( std::make_pair( i - 1, std::vector<std::future<uint32_t>>() ) );
+          for ( uint64_t offset = 0; offset < file.info.uncompressedSize; offset += rangeSize )
+          {
+            uint64_t size = std::min( rangeSize, file.info.uncompressedSize - offset );
+            splits.back().second.push_back( pool->Submit( [this, file, dataOffset, offset, size]()
+            {
+              return ExtractRange( file, dataOffset, offset, size );
+            } ) );
+          }
+        }
+
+        // wait for every task before returning, they refer to this object
+        std::exception_ptr error;
+        for ( size_t i = 0; i < tasks.size(); ++i )
+        {
+          try { tasks[i].get(); }
+          catch ( ... ) { if ( !error ) error = std::current_exception(); }
+        }
+        for ( size_t i = 0; i < splits.size(); ++i )
+        {
+          const ZipEntryInfo &info = files[splits[i].first].info;
+          uint32_t crc = 0;
+          for ( size_t j = 0; j < splits[i].second.size(); ++j )
+          {
+            try { crc = ZipCrc32::Combine( crc, splits[i].second[j].get(), std::min( rangeSize, info.uncompressedSize - j * rangeSize ) ); }
+            catch ( ... ) { if ( !error ) error = std::current_exception(); }
+          }
+          if ( !error && crc != info.ZCRC32 )
+            error = std::make_exception_ptr( ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "CRC-32 mismatch in extracted file." ), 0 ) );
+        }
+        if ( error ) std::rethrow_exception( error );
+      }
+
+      //taken from XrdClZipArchiveReader.cc
+      bool IsOpen() const
+      {
+        return isOpen;
+      }
+
+      // write the central directory and end of central directory record to the archive
+      void Finalize()
+      {
+        EndFile();
+        Flush();
+
+        std::unique_ptr<char[]> tail;
+        uint64_t tailSize = WriteTail( tail );
+        // the tail buffer does not hold the relocated central directory
+        if ( relocationWindow > 0 ) return;
+
+        if ( !indexPath.empty() )
+          ZipIndexFile::Write( indexPath, cdOffset + tailSize, cdOffset, tail.get(), existingCdSize + newCdSize, nbCdRec );
+        if ( !cacheKey.empty() )
+        {
+          ZipTailCache::Instance().Put( cacheKey, std::make_shared<const ZipTailCache::Entry>( cdOffset + tailSize, tailSize, std::move( tail ) ) );
+          cachedTail.reset();
+        }
+      }
+
+      // make the archive readable as it is now without finalizing it: the central directory
+      // and EOCD records are written after the data of the last file in one write, which
+      // the next file appended overwrites, so a long-running writer pays for the tail only
+      // when it wants the archive to be consistent; the files appended so far must have
+      // all their data written, nothing is written if nothing was appended since the last
+      // checkpoint (or since the archive was opened)
+      void Checkpoint()
+      {
+        EndFile();
+        Flush();
+        if ( tailOffset == cdOffset && tailRecords == nbCdRec ) return;
+
+        std::unique_ptr<char[]> tail;
+        WriteTail( tail );
+      }
+
+      // keep a sidecar index of the archive in the local file path (e.g. archive.zip.idx):
+      // it is written by Finalize() and, if it matches the archive, mapped by Open()
+      // instead of reading and indexing the central directory
+      void SetIndexFile( const std::string &path )
+      {
+        indexPath = path;
+      }
+
+      // write the contents of the buffer to the archive
+      // must be called after Append() to ensure correct writeOffset
+      // fileOffset is the offset of the buffer contents in the input file
+      // if the file is compressed or its CRC-32 is computed by the library
+      // the data must be written sequentially
+      void WriteFileData( char *buffer, uint32_t size, uint64_t fileOffset ) 
+      {
+        if ( !PrepareFileData( buffer, size, fileOffset ) ) return;
+
+        XRootDStatus st =	io.Write( writeOffset + fileOffset, size, buffer );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+      }
+
+      // same as WriteFileData() but the write is only queued: the data is copied and sent
+      // in the background with up to maxInFlight writes outstanding (see SetWriteWindow())
+      // the buffer can be reused as soon as the call returns, errors are reported by the
+      // next asynchronous write, by Flush() or by Finalize()
+      void WriteFileDataAsync( const char *buffer, uint32_t size, uint64_t fileOffset )
+      {
+        if ( !PrepareFileData( buffer, size, fileOffset ) ) return;
+
+        if ( !writer ) writer.reset( new ZipAsyncWriter<IO>( io, maxInFlight, asyncBufferSize ) );
+        writer->Write( writeOffset + fileOffset, buffer, size );
+      }
+
+      // number of asynchronous writes kept in flight and the size of their buffers
+      void SetWriteWindow( unsigned maxInFlight, uint32_t bufferSize = defaultAsyncBufferSize )
+      {
+        Flush();
+        writer.reset();
+        this->maxInFlight = maxInFlight;
+        asyncBufferSize = bufferSize;
+      }
+
+      // wait for the asynchronous writes to complete, throws the first error if any failed
+      void Flush()
+      {
+        if ( writer ) writer->Flush();
+      }
+
+      // close the archive
+      void Close()
+      {
+        if ( IsOpen() )
+        {
+          // wait for the pending writes, their errors are reported by Flush() and Finalize()
+          writer.reset();
+
+          // the tail taken from the cache is still valid if nothing was appended
+          if ( cachedTail && cdRecords.Size() == 0 )
+            ZipTailCache::Instance().Put( cacheKey, cachedTail );
+          cachedTail.reset();
+
+          XRootDStatus st = io.Close();
+          if( st.IsOK() ) 
+          {
+            isOpen = false;
+            buffer.reset();
+            openEntries.clear();
+            index.reset();
+            cdBuffer.reset();
+            indexFile.reset();
+          }
+          else
+            throw ZipHandlerException<AnyObject>( &st, 0 );
+        } 
+      }
+
+    private:
+
+      // node of the lock-free list of the files appended concurrently
+      struct ConcurrentNode
+      {
+        ConcurrentNode( std::shared_ptr<ZipConcurrentEntry> entry ) : entry( entry ), next( 0 )
+        {
+
+        }
+
+        std::shared_ptr<ZipConcurrentEntry>  entry;
+        ConcurrentNode                      *next;
+      };
+
+      // common part of WriteFileData() and WriteFileDataAsync(): check the data is
+      // sequential where it has to be, update the CRC-32 or hand the data to the deflater
+      // returns true if the data still has to be written to the archive
+      bool PrepareFileData( const char *buffer, uint32_t size, uint64_t fileOffset )
+      {
+        if ( computeCrc || deflater )
+        {
+          if ( fileOffset != nextFileOffset )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInvalidArgs, errInvalidArgs, "File data must be written sequentially when it is compressed or its CRC-32 is computed by ZipArchive." ), 0 );
+          nextFileOffset += size;
+        }
+
+        if ( deflater )
+        {
+          deflater->Write( buffer, size );
+          return false;
+        }
+
+        if ( computeCrc )
+          crc = ZipCrc32::Update( crc, buffer, size );
+        return true;
+      }
+
+      // serialize the central directory records, ZIP64 EOCD, ZIP64 EOCDL and EOCD into
+      // tail and write it right after the data of the last file, returns its size
+      uint64_t WriteTail( std::unique_ptr<char[]> &tail )
+      {
+        // the central directory goes right after the data of the last file
+        EOCD tailEocd( nbCdRec, existingCdSize + newCdSize, cdOffset );
+        if ( eocd )
+        {
+          // keep the ZIP file comment of the existing archive
+          tailEocd.comment = eocd->comment;
+          tailEocd.commentLength = eocd->commentLength;
+          tailEocd.eocdSize = eocd->eocdSize;
+        }
+
+        // the whole tail is serialized into one buffer so that it takes one write, but for
+        // a relocated central directory, which is moved in place and followed by the rest
+        uint64_t cdInTail = relocationWindow > 0 ? 0 : existingCdSize;
+        uint64_t tailSize = cdInTail + newCdSize + tailEocd.eocdSize;
+        if ( tailEocd.useZip64 )
+          tailSize += ZIP64_EOCD::zip64EocdBaseSize + ZIP64_EOCDL::zip64EocdlSize;
+        tail.reset( new char[tailSize] );
+        char *ptr = tail.get();
+
+        if ( cdInTail > 0 )
+        {
+          std::memcpy( ptr, ExistingCd(), cdInTail );
+          ptr += cdInTail;
+        }
+        ptr = cdRecords.Serialize( ptr );
+        if ( tailEocd.useZip64 )
+        {
+          ZIP64_EOCD tailZip64Eocd( nbCdRec, existingCdSize + newCdSize, cdOffset );
+          ZIP64_EOCDL tailZip64Eocdl( cdOffset + existingCdSize + newCdSize );
+          tailZip64Eocd.Serialize( ptr );
+          ptr += tailZip64Eocd.zip64EocdTotalSize;
+          tailZip64Eocdl.Serialize( ptr );
+          ptr += ZIP64_EOCDL::zip64EocdlSize;
+        }
+        tailEocd.Serialize( ptr );
+
+        if ( relocationWindow > 0 && existingCdSize > 0 )
+        {
+          ZipMoveRegion( io, parkedCdOffset, cdOffset, existingCdSize, relocationWindow );
+          parkedCdOffset = cdOffset;
+        }
+        writeOffset = cdOffset + existingCdSize - cdInTail;
+        WriteBuffer( writeOffset, tailSize, tail.get() );
+        // a central directory moved further than the tail ends leaves bytes after the EOCD
+        uint64_t end = writeOffset + tailSize;
+        if ( relocationWindow > 0 && fileEnd > end )
+        {
+          XRootDStatus st = io.Truncate( end );
+          if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+        }
+        fileEnd = end;
+        // the tail stays valid until something is appended
+        tailOffset = cdOffset;
+        tailRecords = nbCdRec;
+        return tailSize;
+      }
+
+      // before data is written up to end, make sure a relocated central directory is not
+      // in the way: it is moved after end by at least as much as was appended since the
+      // archive was opened, so that it moves a logarithmic number of times
+      void ReserveData( uint64_t end )
+      {
+        if ( relocationWindow == 0 || existingCdSize == 0 || end <= parkedCdOffset ) return;
+        uint64_t offset = end + std::max( end - dataStart, existingCdSize );
+        ZipMoveRegion( io, parkedCdOffset, offset, existingCdSize, relocationWindow );
+        parkedCdOffset = offset;
+        fileEnd = std::max( fileEnd, offset + existingCdSize );
+      }
+
+      // the existing entries are only known if the central directory was read
+      void CheckCdInMemory() const
+      {
+        if ( relocationWindow > 0 && existingCdSize > 0 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errNotSupported, errNotSupported, "The central directory is not in memory when it is relocated." ), 0 );
+      }
+
+      // read a buffer from the archive, in pieces if it is too big for a single request
+      XRootDStatus ReadBuffer( uint64_t offset, uint64_t size, char *buffer )
+      {
+        while ( size > 0 )
+        {
+          uint32_t chunk = std::min<uint64_t>( size, maxWriteSize );
+          uint32_t bytesRead = 0;
+          XRootDStatus st = io.Read( offset, chunk, buffer, bytesRead );
+          if( !st.IsOK() ) return st;
+          if( bytesRead != chunk )
+            return XRootDStatus( stError, errDataError, errDataError, "Unexpected end of the archive." );
+          offset += chunk;
+          buffer += chunk;
+          size -= chunk;
+        }
+        return XRootDStatus();
+      }
+
+      // write a buffer to the archive, in pieces if it is too big for a single request
+      void WriteBuffer( uint64_t offset, uint64_t size, const char *buffer )
+      {
+        do
+        {
+          uint32_t chunk = std::min<uint64_t>( size, maxWriteSize );
+          XRootDStatus st = io.Write( offset, chunk, buffer );
+          if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+          offset += chunk;
+          buffer += chunk;
+          size -= chunk;
+        }
+        while ( size > 0 );
+      }
+
+      // write the files batched by AppendMany()
+      void FlushBatch( std::vector<char> &batch, uint64_t &batchOffset )
+      {
+        if ( !batch.empty() )
+        {
+          ReserveData( batchOffset + batch.size() );
+          WriteBuffer( batchOffset, batch.size(), batch.data() );
+        }
+        batchOffset += batch.size();
+        batch.clear();
+      }
+
+      // append a file that does not fit in a batch, streaming its data in chunks
+      void AppendLarge( const ZipBatchEntry &entry )
+      {
+        Append( entry.filename, entry.size, entry.modTime, entry.mode );
+        const uint32_t chunkSize = defaultBatchSize;
+        std::unique_ptr<char[]> buffer;
+        if ( !entry.data ) buffer.reset( new char[chunkSize] );
+        for ( uint64_t offset = 0; offset < entry.size; offset += chunkSize )
+        {
+          uint32_t size = std::min<uint64_t>( chunkSize, entry.size - offset );
+          char *data = const_cast<char*>( entry.data + offset );
+          if ( !entry.data )
+          {
+            data = buffer.get();
+            ReadInput( entry.fd, data, size, offset );
+          }
+          WriteFileData( data, size, offset );
+        }
+        EndFile();
+      }
+
+      // a piece of work of AppendFiles(): either the files [begin, end) packed in one
+      // buffer with their LFHs, or size bytes of the large file begin from fileOffset
+      struct CopyUnit
+      {
+        CopyUnit( size_t begin ) : begin( begin ), end( begin ), packed( true ), fileOffset( 0 ), size( 0 )
+        {
+
+        }
+
+        CopyUnit( size_t begin, uint64_t fileOffset, uint64_t size ) : begin( begin ), end( begin + 1 ), packed( false ),
+                                                                       fileOffset( fileOffset ), size( size )
+        {
+
+        }
+
+        size_t   begin;
+        size_t   end;
+        bool     packed;
+        uint64_t fileOffset;
+        uint64_t size;
+      };
+
+      // lay out the packed files with their LFHs in a buffer and write it in one request
+      uint32_t CopyPacked( const std::vector<ZipBatchEntry> &entries, std::vector<std::unique_ptr<LFH>> &headers,
+                           const std::vector<uint64_t> &offsets, const CopyUnit &unit )
+      {
+        uint64_t begin = offsets[unit.begin];
+        uint64_t end = offsets[unit.end - 1] + headers[unit.end - 1]->lfhSize + entries[unit.end - 1].size;
+        std::unique_ptr<char[]> buffer( new char[end - begin] );
+        for ( size_t i = unit.begin; i < unit.end; ++i )
+        {
+          char *lfhPos = buffer.get() + ( offsets[i] - begin );
+          char *data = lfhPos + headers[i]->lfhSize;
+          if ( entries[i].data )
+            std::memcpy( data, entries[i].data, entries[i].size );
+          else
+            ReadInput( entries[i].fd, data, entries[i].size, 0 );
+          headers[i]->ZCRC32 = ZipCrc32::Update( 0, data, entries[i].size );
+          headers[i]->Serialize( lfhPos );
+        }
+        XRootDStatus st = io.Write( begin, end - begin, buffer.get() );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( new XRootDStatus( st ), 0 );
+        return 0;
+      }
+
+      // copy a chunk of a large file to its place after the LFH, returns its CRC-32
+      uint32_t CopyChunk( const ZipBatchEntry &entry, const LFH &header, uint64_t lfhOffset, const CopyUnit &unit )
+      {
+        std::unique_ptr<char[]> buffer;
+        const char *data = entry.data + unit.fileOffset;
+        if ( !entry.data )
+        {
+          buffer.reset( new char[unit.size] );
+          ReadInput( entry.fd, buffer.get(), unit.size, unit.fileOffset );
+          data = buffer.get();
+        }
+        uint32_t crc = ZipCrc32::Update( 0, data, unit.size );
+        XRootDStatus st = io.Write( lfhOffset + header.lfhSize + unit.fileOffset, unit.size, data );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( new XRootDStatus( st ), 0 );
+        return crc;
+      }
+
+      // read exactly size bytes of an input file
+      static void ReadInput( int fd, char *buffer, uint64_t size, uint64_t offset )
+      {
+        while ( size > 0 )
+        {
+          ssize_t bytesRead = pread( fd, buffer, size, offset );
+          if ( bytesRead <= 0 )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to read input file." ), 0 );
+          buffer += bytesRead;
+          offset += bytesRead;
+          size -= bytesRead;
+        }
+      }
+
+      void AddCdRecord( const LFH &lfh, mode_t fileMode, uint64_t lfhOffset )
+      {
+        newCdSize += cdRecords.Add( lfh, fileMode, lfhOffset );
+        nbCdRec += 1;
+        if ( index ) index->AddPending( cdRecords.Size() - 1 );
+      }
+
+      ZipEntryReader& OpenedEntry( const std::string &filename )
+      {
+        auto itr = openEntries.find( filename );
+        if ( itr != openEntries.end() ) return *itr->second;
+
+        ZipEntryInfo info;
+        if ( !Find( filename, info ) )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errNotFound, errNotFound, "No such file in the archive." ), 0 );
+
+        Flush();
+        ZipEntryReader *reader = new ZipEntryReader( info, ReadDataOffset( io, info ) );
+        openEntries[filename].reset( reader );
+        return *reader;
+      }
+
+      // read the LFH of an entry, whose filename and extra field lengths tell where the data starts
+      template<typename Reader>
+      static uint64_t ReadDataOffset( Reader &reader, const ZipEntryInfo &info )
+      {
+        char lfhBuffer[LFH::lfhBaseSize];
+        uint32_t bytesRead = 0;
+        XRootDStatus st = reader.Read( info.offset, LFH::lfhBaseSize, lfhBuffer, bytesRead );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+        uint32_t signature;
+        uint16_t filenameLength, extraLength;
+        std::memcpy( &signature, lfhBuffer, 4 );
+        std::memcpy( &filenameLength, lfhBuffer + 26, 2 );
+        std::memcpy( &extraLength, lfhBuffer + 28, 2 );
+        if ( bytesRead != LFH::lfhBaseSize || signature != LFH::lfhSign )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Local file header signature not found." ), 0 );
+        return info.offset + LFH::lfhBaseSize + filenameLength + extraLength;
+      }
+
+      static uint64_t EstimatedDataOffset( const ZipEntryInfo &info )
+      {
+        return info.offset + LFH::lfhBaseSize + info.filenameLength + info.extraLength;
+      }
+
+      // a file to extract and where it goes
+      struct ExtractedFile
+      {
+        ExtractedFile( const std::string &path, const ZipEntryInfo &info ) : path( path ), info( info )
+        {
+
+        }
+
+        bool IsSmall( uint64_t rangeSize ) const
+        {
+          return info.compressedSize <= rangeSize && info.uncompressedSize <= rangeSize;
+        }
+
+        // end of the entry data in the archive, with a margin in case the LFH is larger than expected
+        uint64_t EstimatedEnd() const
+        {
+          return EstimatedDataOffset( info ) + info.compressedSize + lfhMargin;
+        }
+
+        bool operator<( const ExtractedFile &other ) const
+        {
+          return info.offset < other.info.offset;
+        }
+
+        std::string  path;
+        ZipEntryInfo info;
+      };
+
+      // the output path of an entry, names which would escape the directory are rejected
+      static std::string OutputPath( const std::string &directory, const std::string &name )
+      {
+        if ( name.empty() || name[0] == '/' )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Unsafe file name in the archive." ), 0 );
+        for ( size_t begin = 0; begin < name.size(); )
+        {
+          size_t end = name.find( '/', begin );
+          if ( end == std::string::npos ) end = name.size();
+          if ( name.compare( begin, end - begin, ".." ) == 0 )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Unsafe file name in the archive." ), 0 );
+          begin = end + 1;
+        }
+        return directory + "/" + name;
+      }
+
+      // create the directories on the way to path (up to its last '/')
+      static void MakeDirectories( const std::string &path, std::unordered_set<std::string> &created )
+      {
+        for ( size_t end = path.find( '/', 1 ); end != std::string::npos; end = path.find( '/', end + 1 ) )
+        {
+          std::string directory = path.substr( 0, end );
+          if ( !created.insert( directory ).second ) continue;
+          if ( mkdir( directory.c_str(), 0755 ) == -1 && errno != EEXIST )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to create directory." ), 0 );
+        }
+      }
+
+      // create (or truncate) the output file and preallocate its blocks, so that ranges
+      // written concurrently do not fragment it
+      static int CreateOutput( const ExtractedFile &file )
+      {
+        mode_t mode = file.info.Mode() & 07777;
+        int fd = open( file.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode ? mode : 0644 );
+        if ( fd == -1 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to create output file." ), 0 );
+        // not every file system supports it, the file then simply grows as it is written
+        if ( file.info.uncompressedSize > 0 && fallocate( fd, 0, 0, file.info.uncompressedSize ) == -1 &&
+             errno != EOPNOTSUPP && errno != ENOSYS )
+        {
+          int error = errno;
+          close( fd );
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, error, "Failed to allocate output file." ), 0 );
+        }
+        return fd;
+      }
+
+      // write to the output file, which is closed afterwards (also on failure) unless keepOpen
+      static void WriteOutput( int fd, const char *buffer, uint64_t size, uint64_t offset, bool keepOpen = false )
+      {
+        while ( size > 0 )
+        {
+          ssize_t n = pwrite( fd, buffer, size, offset );
+          if ( n == -1 && errno == EINTR ) continue;
+          if ( n <= 0 )
+          {
+            int error = errno;
+            if ( !keepOpen ) close( fd );
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, error, "Failed to write output file." ), 0 );
+          }
+          buffer += n;
+          size -= n;
+          offset += n;
+        }
+        if ( !keepOpen && close( fd ) == -1 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to close output file." ), 0 );
+      }
+
+      // extract a run of small files with a single read of [begin, end) of the archive
+      void ExtractRun( const std::vector<ExtractedFile> &run, uint64_t begin, uint64_t end )
+      {
+        std::vector<Span> spans( 1, Span( begin, end ) );
+        std::unique_ptr<char[]> data( new char[end - begin] );
+        ReadArchive( begin, end - begin, data.get() );
+        SpanReader reader( io, spans, data.get() );
+
+        std::unique_ptr<char[]> output;
+        uint64_t outputSize = 0;
+        for ( size_t i = 0; i < run.size(); ++i )
+        {
+          const ZipEntryInfo &info = run[i].info;
+          if ( info.uncompressedSize > outputSize )
+          {
+            outputSize = info.uncompressedSize;
+            output.reset( new char[outputSize] );
+          }
+          ZipEntryReader entry( info, ReadDataOffset( reader, info ) );
+          const char *contents = output.get();
+          uint32_t size = 0;
+          if ( info.compressionMethod == 0 && entry.DataOffset() + info.uncompressedSize <= end )
+          {
+            // stored and fetched already, write it from the run buffer
+            contents = data.get() + ( entry.DataOffset() - begin );
+            size = info.uncompressedSize;
+          }
+          else
+            size = entry.Read( reader, 0, info.uncompressedSize, output.get() );
+          if ( size != info.uncompressedSize || ZipCrc32::Update( 0, contents, size ) != info.ZCRC32 )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "CRC-32 mismatch in extracted file." ), 0 );
+          WriteOutput( CreateOutput( run[i] ), contents, size, 0 );
+        }
+      }
+
+      // extract size bytes from offset of a large stored file, returns their CRC-32
+      uint32_t ExtractRange( const ExtractedFile &file, uint64_t dataOffset, uint64_t offset, uint64_t size )
+      {
+        std::unique_ptr<char[]> data( new char[size] );
+        ReadArchive( dataOffset + offset, size, data.get() );
+        int fd = open( file.path.c_str(), O_WRONLY );
+        if ( fd == -1 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to open output file." ), 0 );
+        WriteOutput( fd, data.get(), size, offset );
+        return ZipCrc32::Update( 0, data.get(), size );
+      }
+
+      // inflate a large deflated file in one stream, rangeSize bytes at a time
+      void ExtractDeflated( const ExtractedFile &file, uint64_t dataOffset, uint64_t rangeSize )
+      {
+        ZipEntryReader entry( file.info, dataOffset );
+        std::unique_ptr<char[]> output( new char[rangeSize] );
+        int fd = CreateOutput( file );
+        uint64_t offset = 0;
+        uint32_t crc = 0;
+        try
+        {
+          while ( offset < file.info.uncompressedSize )
+          {
+            uint32_t size = entry.Read( io, offset, rangeSize, output.get() );
+            if ( size == 0 ) break;
+            WriteOutput( fd, output.get(), size, offset, true );
+            crc = ZipCrc32::Update( crc, output.get(), size );
+            offset += size;
+          }
+        }
+        catch ( ... )
+        {
+          close( fd );
+          throw;
+        }
+        if ( close( fd ) == -1 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errOSError, errno, "Failed to close output file." ), 0 );
+        if ( offset != file.info.uncompressedSize || crc != file.info.ZCRC32 )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "CRC-32 mismatch in extracted file." ), 0 );
+      }
+
+      // read exactly size bytes of the archive, safe to call from the pool
+      void ReadArchive( uint64_t offset, uint64_t size, char *buffer )
+      {
+        while ( size > 0 )
+        {
+          uint32_t chunk = std::min( uint64_t( maxWriteSize ), size );
+          uint32_t bytesRead = 0;
+          XRootDStatus st = io.Read( offset, chunk, buffer, bytesRead );
+          if ( !st.IsOK() ) throw ZipHandlerException<AnyObject>( new XRootDStatus( st ), 0 );
+          if ( bytesRead == 0 )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "Unexpected end of the archive." ), 0 );
+          offset += bytesRead;
+          size -= bytesRead;
+          buffer += bytesRead;
+        }
+      }
+
+      // a byte range of the archive, [begin, end), and where it is in the buffer of ReadSpans()
+      struct Span
+      {
+        Span( uint64_t begin, uint64_t end ) : begin( begin ), end( end ), position( 0 )
+        {
+
+        }
+
+        bool operator<( const Span &other ) const
+        {
+          return begin < other.begin;
+        }
+
+        uint64_t begin;
+        uint64_t end;
+        uint64_t position;
+      };
+
+      // sort and merge the spans (ranges less than maxGap apart become one), then read them
+      // with as few vector reads as the backend limits allow into the returned buffer
+      char* ReadSpans( std::vector<Span> &spans, uint32_t maxGap, uint64_t archiveEnd )
+      {
+        std::sort( spans.begin(), spans.end() );
+        std::vector<Span> merged;
+        for ( size_t i = 0; i < spans.size(); ++i )
+        {
+          Span span( spans[i].begin, std::min( spans[i].end, archiveEnd ) );
+          if ( span.begin >= span.end ) continue;
+          if ( !merged.empty() && span.begin <= merged.back().end + maxGap )
+            merged.back().end = std::max( merged.back().end, span.end );
+          else
+            merged.push_back( span );
+        }
+        spans.swap( merged );
+
+        uint64_t total = 0;
+        for ( size_t i = 0; i < spans.size(); ++i )
+        {
+          spans[i].position = total;
+          total += spans[i].end - spans[i].begin;
+        }
+        std::unique_ptr<char[]> data( new char[total] );
+
+        ChunkList chunks;
+        for ( size_t i = 0; i < spans.size(); ++i )
+        {
+          for ( uint64_t offset = spans[i].begin; offset < spans[i].end; offset += IO::maxVectorChunkSize )
+          {
+            uint32_t length = std::min( uint64_t( IO::maxVectorChunkSize ), spans[i].end - offset );
+            chunks.push_back( ChunkInfo( offset, length, data.get() + spans[i].position + ( offset - spans[i].begin ) ) );
+            if ( chunks.size() == IO::maxVectorChunks ) VectorRead( chunks );
+          }
+        }
+        VectorRead( chunks );
+        return data.release();
+      }
+
+      void VectorRead( ChunkList &chunks )
+      {
+        if ( chunks.empty() ) return;
+        XRootDStatus st = io.VectorRead( chunks );
+        if( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+        chunks.clear();
+      }
+
+      // reads from the spans fetched by ReadSpans(), and from the archive what is not in them
+      struct SpanReader
+      {
+        SpanReader( IO &io, const std::vector<Span> &spans, const char *data ) : io( io ), spans( spans ), data( data )
+        {
+
+        }
+
+        XRootDStatus Read( uint64_t offset, uint32_t size, void *buffer, uint32_t &bytesRead )
+        {
+          auto itr = std::upper_bound( spans.begin(), spans.end(), Span( offset, offset ) );
+          if ( itr != spans.begin() && offset + size <= ( itr - 1 )->end )
+          {
+            --itr;
+            std::memcpy( buffer, data + itr->position + ( offset - itr->begin ), size );
+            bytesRead = size;
+            return XRootDStatus();
+          }
+          return io.Read( offset, size, buffer, bytesRead );
+        }
+
+        IO                      &io;
+        const std::vector<Span> &spans;
+        const char              *data;
+      };
+
+      // the index over the central directory is built on first use
+      ZipCdIndex& Index()
+      {
+        EndConcurrent();
+        if ( !index ) CheckCdInMemory();
+        if ( !index && indexFile )
+          index.reset( new ZipCdIndex( indexFile->Cd(), indexFile->CdSize(), indexFile->Slots(), indexFile->Capacity(), indexFile->NbEntries(), cdRecords ) );
+        if ( !index )
+        {
+          // large central directories are decoded on the pool of threads
+          if ( existingCdSize >= parallelParseSize && nbThreads != 1 && !pool ) pool.reset( new ZipThreadPool( nbThreads ) );
+          ZipThreadPool *parsePool = existingCdSize >= parallelParseSize ? pool.get() : 0;
+          index.reset( new ZipCdIndex( cdBuffer.get(), existingCdSize, nbCdRec - cdRecords.Size(), cdRecords, parsePool ) );
+        }
+        return *index;
+      }
+
+      // open with the tail from the cache instead of reading it, false if there is no tail
+      // in the cache for this archive or it is stale
+      bool OpenFromCache()
+      {
+        if ( cacheKey.empty() ) return false;
+        std::shared_ptr<const ZipTailCache::Entry> entry = ZipTailCache::Instance().Take( cacheKey );
+        if ( !entry || entry->archiveSize != archiveSize ) return false;
+
+        if ( verifyCachedTail )
+        {
+          uint32_t size = std::min( uint64_t( tailCheckSize ), entry->tailSize );
+          std::unique_ptr<char[]> end( new char[size] );
+          uint32_t bytesRead = 0;
+          XRootDStatus st = io.Read( archiveSize - size, size, end.get(), bytesRead );
+          if ( !st.IsOK() ) throw ZipHandlerException<AnyObject>( new XRootDStatus( st ), 0 );
+          if ( bytesRead != size || std::memcmp( end.get(), entry->tail.get() + ( entry->tailSize - size ), size ) != 0 )
+            return false;
+        }
+
+        // the cached tail holds everything ReadCentralDirectory() needs, nothing is read
+        buffer.reset( new char[entry->tailSize] );
+        std::memcpy( buffer.get(), entry->tail.get(), entry->tailSize );
+        XRootDStatus st = ReadCentralDirectory( entry->tailSize );
+        if ( !st.IsOK() ) throw ZipHandlerException<AnyObject>( &st, 0 );
+        buffer.reset();
+        cachedTail = entry;
+        return true;
+      }
+
+      // the central directory of the archive when it was opened
+      const char* ExistingCd() const
+      {
+        return indexFile ? indexFile->Cd() : cdBuffer.get();
+      }
+
+      ZipEntryWriter<IO> AppendConcurrent( std::string filename, uint32_t crc, uint64_t fileSize, time_t fileModTime, mode_t fileMode, bool computeCrc )
+      {
+        if ( !concurrent )
+          throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errInvalidOp, errInvalidOp, "AppendConcurrent() called before BeginConcurrent()." ), 0 );
+        std::unique_ptr<LFH> header( new LFH( filename, crc, fileSize, fileModTime ) );
+        uint64_t offset = dataEnd.fetch_add( header->lfhSize + fileSize );
+        if ( !computeCrc ) header->Write( io, offset );
+        std::shared_ptr<ZipConcurrentEntry> entry = std::make_shared<ZipConcurrentEntry>( header.release(), fileMode, offset, !computeCrc );
+
+        // push the entry on the lock-free list
+        ConcurrentNode *node = new ConcurrentNode( entry );
+        node->next = concurrentEntries.load( std::memory_order_relaxed );
+        while ( !concurrentEntries.compare_exchange_weak( node->next, node, std::memory_order_release, std::memory_order_relaxed ) );
+        return ZipEntryWriter<IO>( io, entry, fileSize, computeCrc );
+      }
+
+      // record the CDFH of the new file and write its LFH after the data of the previous file
+      void WriteLfh( mode_t fileMode )
+      {
+        AddCdRecord( *lfh, fileMode, cdOffset );
+
+        writeOffset = cdOffset;
+        lfh->Write( io, writeOffset );
+        writeOffset += lfh->lfhSize;
+        cdOffset = writeOffset;
+      }
+
+      // complete the last appended file: finish its compression and write the final
+      // crc and sizes into its LFH (already in the archive) and into its CDFH
+      void EndFile()
+      {
+        EndConcurrent();
+        if ( deflater )
+        {
+          deflater->Finish();
+          uint64_t compressedSize = deflater->CompressedSize();
+          uint64_t uncompressedSize = deflater->UncompressedSize();
+          if ( lfh->extraLength == 0 && ( compressedSize >= ovrflw32 || uncompressedSize >= ovrflw32 ) )
+            throw ZipHandlerException<AnyObject>( new XRootDStatus( stError, errDataError, errDataError, "File data exceeds the size given to AppendDeflated()." ), 0 );
+          lfh->SetSizes( deflater->Crc(), compressedSize, uncompressedSize );
+          cdOffset += compressedSize;
+          deflater.reset();
+        }
+        else if ( computeCrc )
+        {
+          computeCrc = false;
+          lfh->ZCRC32 = crc;
+        }
+        else
+          return;
+
+        lfh->Write( io, writeOffset - lfh->lfhSize );
+        cdRecords.Update( cdRecords.Size() - 1, *lfh );
+      }
+
+      IO                      io;
+      uint64_t                archiveSize;
+      ZipCdStore              cdRecords;
+      std::unique_ptr<ZipCdIndex>  index;
+      std::unordered_map<std::string, std::unique_ptr<ZipEntryReader>> openEntries;
+      std::unique_ptr<EOCD>        eocd;
+      std::unique_ptr<ZIP64_EOCD>  zip64Eocd;
+      std::unique_ptr<ZIP64_EOCDL> zip64Eocdl;
+      std::unique_ptr<char[]> buffer;
+      std::unique_ptr<char[]> cdBuffer;
+      uint64_t                existingCdSize;
+      uint64_t                writeOffset;
+      bool                    isOpen;
+      uint64_t                nbCdRec;
+      uint64_t                newCdSize;
+      uint64_t                cdOffset;
+      std::unique_ptr<LFH>    lfh;
+      bool                    computeCrc;
+      uint32_t                crc;
+      uint64_t                nextFileOffset;
+      unsigned                nbThreads;
+      std::unique_ptr<ZipThreadPool> pool;
+      std::unique_ptr<ZipDeflater>   deflater;
+      unsigned                       maxInFlight;
+      uint32_t                       asyncBufferSize;
+      std::unique_ptr<ZipAsyncWriter<IO>> writer;
+      uint32_t                       tailWindow;
+      std::string                    indexPath;
+      std::unique_ptr<ZipIndexFile>  indexFile;
+      std::string                    cacheKey;
+      bool                           verifyCachedTail;
+      std::shared_ptr<const ZipTailCache::Entry> cachedTail;
+      bool                              concurrent;
+      std::atomic<uint64_t>             dataEnd;
+      std::atomic<ConcurrentNode*>      concurrentEntries;
+      uint64_t                          tailOffset;
+      uint64_t                          tailRecords;
+      uint32_t                          relocationWindow;
+      uint64_t                          parkedCdOffset;
+      uint64_t                          dataStart;
+      uint64_t                          fileEnd;
+
+      static const uint32_t defaultBatchSize = 8 * 1024 * 1024;
+      static const uint32_t maxWriteSize = 1024 * 1024 * 1024;
+      static const unsigned defaultMaxInFlight = 8;
+      static const uint32_t defaultMaxGap = 64 * 1024;
+      static const uint32_t defaultTailWindow = 1024 * 1024;
+      static const uint32_t tailCheckSize = 4096;
+      static const uint32_t parallelParseSize = 8 * 1024 * 1024;
+      static const uint32_t minTailWindow = EOCD::maxCommentLength + EOCD::eocdBaseSize + ZIP64_EOCDL::zip64EocdlSize;
+      static const uint32_t lfhMargin = 256;
+      static const uint64_t defaultExtractRangeSize = 8 * 1024 * 1024;
+      static const uint32_t defaultAsyncBufferSize = 1024 * 1024;
+      static const uint64_t noTail = ~uint64_t( 0 );
+      static const uint32_t defaultRelocationWindow = 8 * 1024 * 1024;
+  };
+
+  // long-lived appender for many producers: files are submitted from any thread and a
+  // writer thread appends them as they arrive (all that is queued goes in one batch, see
+  // ZipArchiveEngine::AppendMany()), then commits them, i.e. writes the central directory
+  // with Checkpoint(), once maxFiles files or maxBytes bytes are waiting for it or the
+  // oldest of them has waited for maxDelay, so the central directory is rewritten once per
+  // group of files rather than once per file; the future of a file is ready once it is
+  // committed; the archive must be open and must not be used otherwise while the appender
+  // exists, Finalize() it afterwards to write the sidecar index or fill the tail cache
+  template<typename IO>
+  class ZipGroupAppender
+  {
+    public:
+
+      ZipGroupAppender( ZipArchiveEngine<IO> &archive,
+                        std::chrono::milliseconds maxDelay = std::chrono::milliseconds( defaultMaxDelay ),
+                        size_t maxFiles = defaultMaxFiles,
+                        uint64_t maxBytes = defaultMaxBytes ) : archive( archive ),
+                                                                maxDelay( maxDelay ),
+                                                                maxFiles( maxFiles ),
+                                                                maxBytes( maxBytes ),
+                                                                stop( false )
+      {
+        writer = std::thread( &ZipGroupAppender::Run, this );
+      }
+
+      // the files still queued are appended and committed
+      ~ZipGroupAppender()
+      {
+        {
+          std::unique_lock<std::mutex> lock( mutex );
+          stop = true;
+        }
+        cv.notify_one();
+        writer.join();
+      }
+
+      ZipGroupAppender( const ZipGroupAppender& ) = delete;
+      ZipGroupAppender& operator=( const ZipGroupAppender& ) = delete;
+
+      // the data is copied, the caller may reuse its buffer as soon as Submit() returns
+      std::future<void> Submit( std::string filename, const char *data, uint64_t size, time_t modTime, mode_t mode )
+      {
+        Submission submission( filename, -1, size, modTime, mode );
+        submission.data.assign( data, data + size );
+        return Enqueue( std::move( submission ) );
+      }
+
+      // the file is read by the writer thread, fd must stay open until the future is ready
+      std::future<void> Submit( std::string filename, int fd, uint64_t size, time_t modTime, mode_t mode )
+      {
+        return Enqueue( Submission( filename, fd, size, modTime, mode ) );
+      }
+
+      // commit what was submitted so far without waiting for the policy
+      std::future<void> Commit()
+      {
+        Submission submission( std::string(), -1, 0, 0, 0 );
+        submission.commit = true;
+        return Enqueue( std::move( submission ) );
+      }
+
+    private:
+
+      struct Submission
+      {
+        Submission( std::string filename, int fd, uint64_t size, time_t modTime, mode_t mode ) :
+          filename( filename ), fd( fd ), size( size ), modTime( modTime ), mode( mode ), commit( false )
+        {
+
+        }
+
+        std::string         filename;
+        std::vector<char>   data;
+        int                 fd;
+        uint64_t            size;
+        time_t              modTime;
+        mode_t              mode;
+        bool                commit;
+        std::promise<void>  done;
+      };
+
+      std::future<void> Enqueue( Submission submission )
+      {
+        std::future<void> result = submission.done.get_future();
+        {
+          std::unique_lock<std::mutex> lock( mutex );
+          if ( error )
+            submission.done.set_exception( error );
+          else
+            queue.push_back( std::move( submission ) );
+        }
+        cv.notify_one();
+        return result;
+      }
+
+      void Run()
+      {
+        std::vector<Submission> pending; // appended, not committed yet
+        size_t pendingFiles = 0;
+        uint64_t pendingBytes = 0;
+        bool commitNow = false;
+        std::chrono::steady_clock::time_point oldest;
+
+        std::unique_lock<std::mutex> lock( mutex );
+        while ( true )
+        {
+          if ( pending.empty() )
+            cv.wait( lock, [this]{ return stop || !queue.empty(); } );
+          else
+            cv.wait_until( lock, oldest + maxDelay, [this]{ return stop || !queue.empty(); } );
+          std::deque<Submission> batch;
+          batch.swap( queue );
+          bool stopping = stop;
+          lock.unlock();
+
+          try
+          {
+            if ( pending.empty() ) oldest = std::chrono::steady_clock::now();
+            size_t first = pending.size();
+            for ( size_t i = 0; i < batch.size(); ++i )
+              pending.push_back( std::move( batch[i] ) );
+
+            std::vector<ZipBatchEntry> entries;
+            for ( size_t i = first; i < pending.size(); ++i )
+            {
+              Submission &submission = pending[i];
+              if ( submission.commit )
+              {
+                commitNow = true;
+                continue;
+              }
+              if ( submission.fd == -1 )
+                entries.push_back( ZipBatchEntry( submission.filename, submission.data.data(), submission.size, submission.modTime, submission.mode ) );
+              else
+                entries.push_back( ZipBatchEntry( submission.filename, submission.fd, submission.size, submission.modTime, submission.mode ) );
+              pendingBytes += submission.size;
+            }
+            if ( !entries.empty() ) archive.AppendMany( entries );
+            pendingFiles += entries.size();
+            // the data is in the archive, only the promises wait for the commit
+            for ( size_t i = first; i < pending.size(); ++i )
+              std::vector<char>().swap( pending[i].data );
+
+            if ( commitNow || stopping || pendingFiles >= maxFiles || pendingBytes >= maxBytes ||
+                 std::chrono::steady_clock::now() >= oldest + maxDelay )
+            {
+              if ( pendingFiles > 0 ) archive.Checkpoint();
+              for ( size_t i = 0; i < pending.size(); ++i )
+                pending[i].done.set_value();
+              pending.clear();
+              pendingFiles = 0;
+              pendingBytes = 0;
+              commitNow = false;
+            }
+          }
+          catch ( ... )
+          {
+            // after an error the state of the archive is unknown, nothing more is appended
+            std::exception_ptr failure = std::current_exception();
+            for ( size_t i = 0; i < pending.size(); ++i )
+              pending[i].done.set_exception( failure );
+            pending.clear();
+            pendingFiles = 0;
+            pendingBytes = 0;
+            commitNow = false;
+            lock.lock();
+            error = failure;
+            for ( size_t i = 0; i < queue.size(); ++i )
+              queue[i].done.set_exception( failure );
+            queue.clear();
+            if ( stopping ) break;
+            continue;
+          }
+
+          lock.lock();
+          if ( stopping && queue.empty() ) break;
+        }
+      }
+
+      ZipArchiveEngine<IO>          &archive;
+      std::chrono::milliseconds      maxDelay;
+      size_t                         maxFiles;
+      uint64_t                       maxBytes;
+      std::deque<Submission>         queue;
+      std::exception_ptr             error;
+      bool                           stop;
+      std::mutex                     mutex;
+      std::condition_variable        cv;
+      std::thread                    writer;
+
+      static const unsigned defaultMaxDelay = 100;
+      static const size_t   defaultMaxFiles = 256;
+      static const uint64_t defaultMaxBytes = 64 * 1024 * 1024;
+  };
+
+}
+
+#endif // __ZIP_ARCHIVE_HH__